@@ -0,0 +1,380 @@
+#include <QApplication>
+#include <QSettings>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QPainter>
+#include <QLineEdit>
+#include <QLabel>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QThread>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <getopt.h>
+#include <unistd.h>
+#include "../src/viewer.h"
+#include "../src/download.h"
+#include "../src/resourcemanager.h"
+#include "../src/kpage.h"
+#include "../src/search.h"
+#include "../src/config.h"
+#include "../src/util.h"
+#include "../src/layout/gridlayout.h"
+
+using namespace std;
+
+
+// how often to look for finished work
+static const useconds_t poll_interval = 500; // us
+
+
+// durations of the runs of one benchmark
+class Samples {
+public:
+	Samples(const char *name);
+
+	void start();
+	void stop();
+	// amount of work done in all runs, for the throughput
+	void print(double amount, const char *unit) const;
+
+private:
+	qint64 percentile(const vector<qint64> &sorted, int p) const;
+
+	const char *name;
+	QElapsedTimer clock;
+	vector<qint64> times; // ns
+};
+
+Samples::Samples(const char *name) :
+		name(name) {
+}
+
+void Samples::start() {
+	clock.start();
+}
+
+void Samples::stop() {
+	times.push_back(clock.nsecsElapsed());
+}
+
+qint64 Samples::percentile(const vector<qint64> &sorted, int p) const {
+	return sorted[(sorted.size() - 1) * p / 100];
+}
+
+void Samples::print(double amount, const char *unit) const {
+	if (times.empty()) {
+		printf("%-16s no runs\n", name);
+		return;
+	}
+	vector<qint64> sorted = times;
+	sort(sorted.begin(), sorted.end());
+	qint64 total = 0;
+	for (unsigned int i = 0; i < sorted.size(); i++) {
+		total += sorted[i];
+	}
+	printf("%-16s %5d runs %10.1f %s/s   p50 %8.3f ms   p90 %8.3f ms   p99 %8.3f ms   max %8.3f ms\n",
+			name, (int) sorted.size(), amount / (total / 1e9), unit,
+			percentile(sorted, 50) / 1e6, percentile(sorted, 90) / 1e6,
+			percentile(sorted, 99) / 1e6, sorted.back() / 1e6);
+}
+
+
+static void wait_a_bit() {
+	QCoreApplication::processEvents();
+	usleep(poll_interval);
+}
+
+// renders the first pages one after another, like paging through the document
+static void bench_render(ResourceManager *res, int width, int iterations) {
+	if (res->use_tiles(width, width / res->get_min_aspect())) {
+		cerr << "pages of width " << width << " are rendered in tiles, choose a smaller one" << endl;
+		return;
+	}
+	int pages = min(iterations, res->get_page_count());
+	Samples s("render");
+	for (int page = 0; page < pages; page++) {
+		s.start();
+		// the previous page is out of view
+		res->collect_garbage(page, page, 0, page, page);
+		while (1) {
+			const KPage *kp = res->get_page(page, width, 0);
+			bool done = kp->get_width(0) == width;
+			res->unlock_page(page);
+			if (done) {
+				break;
+			}
+			wait_a_bit();
+		}
+		s.stop();
+	}
+	s.print(pages, "pages");
+}
+
+// searches the whole document, the way the search bar does it
+static void bench_search(Viewer *viewer, const QString &term, int iterations) {
+	SearchBar *bar = viewer->get_search_bar();
+	if (!bar->is_valid()) {
+		return;
+	}
+	QLineEdit *line = bar->findChild<QLineEdit *>();
+	QLabel *progress = bar->findChild<QLabel *>();
+	QString done = QString::fromUtf8("] done");
+
+	Samples s("search");
+	for (int i = 0; i < iterations; i++) {
+		// the same term is not searched twice in a row
+		bar->reset_search();
+		bar->focus(true);
+		line->setText(term);
+
+		s.start();
+		QMetaObject::invokeMethod(line, "returnPressed");
+		while (!progress->text().contains(done)) {
+			wait_a_bit();
+		}
+		s.stop();
+	}
+	s.print((double) iterations * viewer->get_res()->get_page_count(), "pages");
+	printf("%-16s %s\n", "", progress->text().toUtf8().constData());
+	bar->reset_search();
+}
+
+// relayouting, scrolling and drawing a grid layout into an image
+static void bench_layout(Viewer *viewer, int iterations) {
+	ResourceManager *res = viewer->get_res();
+	while (!res->are_page_sizes_loaded()) {
+		wait_a_bit();
+	}
+
+	GridLayout layout(viewer, 0);
+	Samples resize("layout resize");
+	for (int i = 0; i < iterations; i++) {
+		resize.start();
+		layout.resize(800 + i % 8 * 32, 600); // recalculates all constants
+		resize.stop();
+	}
+	resize.print(iterations, "layouts");
+
+	Samples columns("layout columns");
+	for (int i = 0; i < iterations; i++) {
+		columns.start();
+		layout.set_columns(1 + i % 4, false);
+		columns.stop();
+	}
+	columns.print(iterations, "layouts");
+
+	layout.set_columns(1, false);
+	QImage frame(1024, 768, QImage::Format_ARGB32_Premultiplied);
+	layout.resize(frame.width(), frame.height());
+	Samples scroll("layout scroll");
+	Samples paint("layout render");
+	for (int i = 0; i < iterations; i++) {
+		scroll.start();
+		layout.scroll_smooth(0, -frame.height() / 4);
+		scroll.stop();
+
+		paint.start();
+		frame.fill(0);
+		QPainter painter(&frame);
+		layout.render(&painter);
+		painter.end();
+		paint.stop();
+		QCoreApplication::processEvents();
+	}
+	scroll.print(iterations, "scrolls");
+	paint.print(iterations, "frames");
+}
+
+// the per-pixel float loop invert_image used before the vector versions,
+// as a baseline
+static void invert_image_reference(QImage *img) {
+	static QRgb invert_mask = qRgba(255, 255, 255, 0);
+	static float inverted_contrast =
+			CFG::get_instance()->get_value("Settings/inverted_color_contrast").toFloat();
+	static int offset = 255 *
+			CFG::get_instance()->get_value("Settings/inverted_color_brightening").toFloat();
+
+	QRgb *pixels = reinterpret_cast<QRgb *>(img->bits());
+	QRgb *pixels_end = pixels + img->width() * img->height();
+	while (pixels < pixels_end) {
+		*pixels ^= invert_mask;
+		*pixels = qRgb(
+				(qRed(*pixels)) * inverted_contrast + offset,
+				(qGreen(*pixels)) * inverted_contrast + offset,
+				(qBlue(*pixels)) * inverted_contrast + offset);
+		++pixels;
+	}
+}
+
+// a noisy A4 page at 150 dpi
+static void bench_invert(int iterations) {
+	QImage img(1240, 1754, QImage::Format_ARGB32_Premultiplied);
+	quint32 seed = 1;
+	for (int y = 0; y < img.height(); y++) {
+		QRgb *line = reinterpret_cast<QRgb *>(img.scanLine(y));
+		for (int x = 0; x < img.width(); x++) {
+			seed = seed * 1103515245 + 12345;
+			line[x] = seed | 0xff000000;
+		}
+	}
+
+	QImage reference = img.copy();
+	Samples old_loop("invert (old)");
+	for (int i = 0; i < iterations; i++) {
+		old_loop.start();
+		invert_image_reference(&reference);
+		old_loop.stop();
+	}
+	old_loop.print((double) iterations * img.width() * img.height() / 1e6, "Mpixels");
+
+	Samples s("invert");
+	for (int i = 0; i < iterations; i++) {
+		s.start();
+		invert_image(&img);
+		s.stop();
+	}
+	s.print((double) iterations * img.width() * img.height() / 1e6, "Mpixels");
+
+	// both started from the same pixels and ran equally often
+	if (img != reference) {
+		cerr << "invert: result differs from the old loop" << endl;
+	}
+}
+
+
+static void print_help(char *name) {
+	cout << "Usage:" << endl;
+	cout << "  " << name << " [OPTIONS] FILE|URL" << endl;
+	cout << endl;
+	cout << "Runs benchmarks on FILE without opening a window, a URL is downloaded first." << endl;
+	cout << "The configuration file is ignored, only the built-in defaults and --set apply." << endl;
+	cout << endl;
+	cout << "Options:" << endl;
+	cout << "  -n, --iterations NUM      Runs per benchmark, pages for render (default 50)" << endl;
+	cout << "  -w, --width NUM           Width of rendered pages in pixels (default 1000)" << endl;
+	cout << "  -t, --term TERM           Search term (default \"the\")" << endl;
+	cout << "  -b, --bench LIST          Comma separated benchmarks to run, out of" << endl;
+	cout << "                            render,search,layout,invert (default all)" << endl;
+	cout << "  -s, --set KEY=VALUE       Change a setting, e.g. Settings/render_threads=1" << endl;
+	cout << "  -h, --help                Print this help and exit" << endl;
+}
+
+int main(int argc, char *argv[]) {
+#if QT_VERSION >= 0x050000
+	if (qgetenv("QT_QPA_PLATFORM").isEmpty()) {
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	}
+#endif
+	QApplication app(argc, argv);
+
+	// keep the user's configuration out of the measurements
+	QString config_dir = QDir::temp().filePath(QString::fromUtf8("katarakt-bench-%1").arg(getpid()));
+	QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, config_dir);
+	CFG *config = CFG::get_instance();
+	// the index makes search times depend on how far it got in the background
+	config->set_value("Settings/search_index", false);
+
+	struct option long_options[] = {
+		{"iterations",	required_argument,	NULL,	'n'},
+		{"width",		required_argument,	NULL,	'w'},
+		{"term",		required_argument,	NULL,	't'},
+		{"bench",		required_argument,	NULL,	'b'},
+		{"set",			required_argument,	NULL,	's'},
+		{"help",		no_argument,		NULL,	'h'},
+		{NULL, 0, NULL, 0}
+	};
+	int iterations = 50;
+	int width = 1000;
+	QString term = QString::fromUtf8("the");
+	QStringList benches = QString::fromUtf8("render,search,layout,invert").split(QChar::fromLatin1(','));
+	while (1) {
+		int c = getopt_long(argc, argv, "+n:w:t:b:s:h", long_options, NULL);
+		if (c == -1) {
+			break;
+		}
+		switch (c) {
+			case 'n':
+				iterations = max(1, atoi(optarg));
+				break;
+			case 'w':
+				width = max(1, atoi(optarg));
+				break;
+			case 't':
+				term = QString::fromLocal8Bit(optarg);
+				break;
+			case 'b':
+				benches = QString::fromLocal8Bit(optarg).split(QChar::fromLatin1(','));
+				break;
+			case 's': {
+				QString setting = QString::fromLocal8Bit(optarg);
+				int equals = setting.indexOf(QChar::fromLatin1('='));
+				if (equals <= 0) {
+					cerr << "expected KEY=VALUE: " << optarg << endl;
+					return 1;
+				}
+				config->set_value(setting.left(equals).toUtf8().constData(), setting.mid(equals + 1));
+				break;
+			}
+			case 'h':
+				print_help(argv[0]);
+				return 0;
+			default:
+				print_help(argv[0]);
+				return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		print_help(argv[0]);
+		return 1;
+	}
+
+	int ret = 0;
+	// a URL, e.g. of a local test server, is downloaded first
+	QString file = QString::fromLocal8Bit(argv[optind]);
+	Download download;
+	if (file.contains(QString::fromUtf8("://"))) {
+		Samples s("download");
+		s.start();
+		file = download.load(file);
+		s.stop();
+		cout << endl;
+		if (file.isNull()) {
+			ret = 1;
+		} else {
+			s.print(QFileInfo(file).size() / 1024.0 / 1024.0, "MiB");
+		}
+	}
+
+	if (!file.isNull()) {
+		Viewer viewer(file);
+		ResourceManager *res = viewer.get_res();
+		if (!viewer.is_valid() || !res->is_valid()) {
+			cerr << "failed to open " << argv[optind] << endl;
+			ret = 1;
+		} else {
+			printf("%s: %d pages, %d cores\n", argv[optind], res->get_page_count(), QThread::idealThreadCount());
+			if (benches.contains(QString::fromUtf8("render"))) {
+				bench_render(res, width, iterations);
+			}
+			if (benches.contains(QString::fromUtf8("search"))) {
+				bench_search(&viewer, term, iterations);
+			}
+			if (benches.contains(QString::fromUtf8("layout"))) {
+				bench_layout(&viewer, iterations);
+			}
+		}
+	}
+	if (ret == 0 && benches.contains(QString::fromUtf8("invert"))) {
+		bench_invert(iterations);
+	}
+
+	QFile::remove(QDir(config_dir).filePath(QString::fromUtf8("katarakt.ini")));
+	QDir().rmdir(config_dir);
+	return ret;
+}
+
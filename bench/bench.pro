@@ -0,0 +1,5 @@
+TEMPLATE = app
+TARGET = katarakt-bench
+include(../katarakt.pri)
+
+SOURCES += bench.cpp
@@ -0,0 +1,41 @@
+# everything but main(), shared by katarakt.pro and bench/bench.pro
+DEPENDPATH += $$PWD
+INCLUDEPATH += $$PWD
+CONFIG += qt
+QT += network xml dbus
+
+greaterThan(QT_MAJOR_VERSION, 4) {
+    QT += widgets
+    DEFINES += QT_DEPRECATED_WARNINGS
+}
+POPPLER = poppler-qt$$QT_MAJOR_VERSION
+
+unix {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += $$POPPLER
+
+    isEmpty(PKG_CONFIG):PKG_CONFIG = pkg-config    # same as in link_pkgconfig.prf
+    POPPLER_VERSION = $$system($$PKG_CONFIG --modversion $$POPPLER)
+    POPPLER_VERSION_MAJOR = $$system(echo "$$POPPLER_VERSION" | cut -d . -f 1)
+    POPPLER_VERSION_MINOR = $$system(echo "$$POPPLER_VERSION" | cut -d . -f 2)
+    POPPLER_VERSION_MICRO = $$system(echo "$$POPPLER_VERSION" | cut -d . -f 3)
+
+    DEFINES += POPPLER_VERSION_MAJOR=$$POPPLER_VERSION_MAJOR
+    DEFINES += POPPLER_VERSION_MINOR=$$POPPLER_VERSION_MINOR
+    DEFINES += POPPLER_VERSION_MICRO=$$POPPLER_VERSION_MICRO
+}
+
+DEFINES += QT_NO_CAST_FROM_ASCII QT_NO_CAST_TO_ASCII
+
+QMAKE_CXXFLAGS_DEBUG += -DDEBUG
+
+# Input
+HEADERS +=  $$PWD/src/layout/layout.h $$PWD/src/layout/singlelayout.h $$PWD/src/layout/gridlayout.h $$PWD/src/layout/presenterlayout.h \
+            $$PWD/src/viewer.h $$PWD/src/canvas.h $$PWD/src/resourcemanager.h $$PWD/src/grid.h $$PWD/src/search.h $$PWD/src/gotoline.h $$PWD/src/config.h \
+            $$PWD/src/download.h $$PWD/src/util.h $$PWD/src/kpage.h $$PWD/src/worker.h $$PWD/src/beamerwindow.h $$PWD/src/toc.h $$PWD/src/splitter.h $$PWD/src/selection.h $$PWD/src/diskcache.h $$PWD/src/searchindex.h $$PWD/src/scheduler.h $$PWD/src/textworker.h $$PWD/src/textlayout.h $$PWD/src/thumbnails.h $$PWD/src/profiler.h $$PWD/src/documentpool.h $$PWD/src/reloadworker.h \
+            $$PWD/src/dbus/source_correlate.h $$PWD/src/dbus/dbus.h
+
+SOURCES +=  $$PWD/src/layout/layout.cpp $$PWD/src/layout/singlelayout.cpp $$PWD/src/layout/gridlayout.cpp $$PWD/src/layout/presenterlayout.cpp \
+            $$PWD/src/viewer.cpp $$PWD/src/canvas.cpp $$PWD/src/resourcemanager.cpp $$PWD/src/grid.cpp $$PWD/src/search.cpp $$PWD/src/gotoline.cpp $$PWD/src/config.cpp \
+            $$PWD/src/download.cpp $$PWD/src/util.cpp $$PWD/src/kpage.cpp $$PWD/src/worker.cpp $$PWD/src/beamerwindow.cpp $$PWD/src/toc.cpp $$PWD/src/splitter.cpp \
+            $$PWD/src/selection.cpp $$PWD/src/diskcache.cpp $$PWD/src/searchindex.cpp $$PWD/src/scheduler.cpp $$PWD/src/textworker.cpp $$PWD/src/textlayout.cpp $$PWD/src/thumbnails.cpp $$PWD/src/profiler.cpp $$PWD/src/documentpool.cpp $$PWD/src/reloadworker.cpp $$PWD/src/dbus/source_correlate.cpp $$PWD/src/dbus/dbus.cpp
@@ -18,7 +18,8 @@ BeamerWindow::BeamerWindow(Viewer *v, QWidget *parent) :
 		valid(false) {
 	setFocusPolicy(Qt::StrongFocus);
 
-	layout = new SingleLayout(viewer, 0);
+	// the last image slot, the canvas uses the others
+	layout = new SingleLayout(viewer, render_index_count - 1);
 
 	CFG *config = CFG::get_instance();
 	mouse_wheel_factor = config->get_value("Settings/mouse_wheel_factor").toInt();
@@ -105,3 +106,8 @@ void BeamerWindow::page_rendered(int page) {
 	}
 }
 
+void BeamerWindow::page_sizes_changed(int first, int last) {
+	layout->update_page_sizes(first, last);
+	update();
+}
+
@@ -35,6 +35,7 @@ protected:
 
 private slots:
 	void page_rendered(int page);
+	void page_sizes_changed(int first, int last);
 
 private:
 	Viewer *viewer;
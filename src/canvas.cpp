@@ -19,6 +19,7 @@
 #include "gotoline.h"
 #include "config.h"
 #include "beamerwindow.h"
+#include "profiler.h"
 #include "util.h"
 
 using namespace std;
@@ -122,6 +123,13 @@ Canvas::Canvas(Viewer *v, QWidget *parent) :
 	page_overlay->setAutoFillBackground(true);
 	page_overlay->show();
 
+	hud = new QLabel(this);
+	hud->setMargin(1);
+	hud->setAutoFillBackground(true);
+	hud->hide();
+	hud_timer.setInterval(1000);
+	connect(&hud_timer, SIGNAL(timeout()), this, SLOT(update_hud()), Qt::UniqueConnection);
+
 	// setup beamer
 	BeamerWindow *beamer = viewer->get_beamer();
 	setup_keys(beamer);
@@ -135,6 +143,7 @@ Canvas::Canvas(Viewer *v, QWidget *parent) :
 }
 
 Canvas::~Canvas() {
+	delete hud;
 	delete page_overlay;
 	delete goto_line;
 	delete single_layout;
@@ -160,6 +169,7 @@ void Canvas::setup_keys(QWidget *base) {
 	add_action(base, "Keys/set_presenter_layout", SLOT(set_presenter_layout()), this);
 
 	add_action(base, "Keys/toggle_overlay", SLOT(toggle_overlay()), this);
+	add_action(base, "Keys/toggle_hud", SLOT(toggle_hud()), this);
 	add_action(base, "Keys/swap_selection_and_panning_buttons", SLOT(swap_selection_and_panning_buttons()), this);
 }
 
@@ -178,19 +188,25 @@ void Canvas::update_page_overlay() {
 	page_overlay->setText(frozen_text + overlay_text);
 	page_overlay->adjustSize();
 	page_overlay->move(width() - page_overlay->width(), height() - page_overlay->height());
+	hud->move(width() - hud->width(), page_overlay->y() - hud->height());
 }
 
 void Canvas::paintEvent(QPaintEvent * /*event*/) {
 #ifdef DEBUG
 	cerr << "redraw" << endl;
 #endif
+	Profiler *profiler = Profiler::get_instance();
+	qint64 paint_start = profiler->begin();
 	QPainter painter(this);
 	if (viewer->isFullScreen()) {
 		painter.fillRect(rect(), background_fullscreen);
 	} else {
 		painter.fillRect(rect(), background);
 	}
+	qint64 layout_start = profiler->begin();
 	cur_layout->render(&painter);
+	profiler->end(Profile::Layout, layout_start);
+	profiler->end(Profile::Paint, paint_start);
 }
 
 void Canvas::mousePressEvent(QMouseEvent *event) {
@@ -367,6 +383,7 @@ void Canvas::resizeEvent(QResizeEvent *event) {
 	cur_layout->resize(event->size().width(), event->size().height());
 	goto_line->move(0, height() - goto_line->height());
 	page_overlay->move(width() - page_overlay->width(), height() - page_overlay->height());
+	hud->move(width() - hud->width(), page_overlay->y() - hud->height());
 }
 
 // primitive actions
@@ -413,6 +430,43 @@ void Canvas::toggle_overlay() {
 	page_overlay->setVisible(!page_overlay->isVisible());
 }
 
+void Canvas::toggle_hud() {
+	bool visible = !hud->isVisible();
+	Profiler::get_instance()->set_hud_visible(visible);
+	if (visible) {
+		Profiler::get_instance()->get_summary(); // start a fresh interval
+		update_hud();
+		hud->show();
+		hud_timer.start();
+	} else {
+		hud->hide();
+		hud_timer.stop();
+	}
+}
+
+void Canvas::update_hud() {
+	ResourceManager *res = viewer->get_res();
+	SchedulerStats stats = res->get_render_stats();
+	QString text = Profiler::get_instance()->get_summary();
+	text += QString::fromUtf8("queued: %1 visible, %2 prefetch\n")
+		.arg(stats.depth[Render::Visible])
+		.arg(stats.depth[Render::Prefetch]);
+	if (stats.started[Render::Visible] > 0) {
+		text += QString::fromUtf8("wait: %1 ms, max %2 ms\n")
+			.arg(stats.total_wait[Render::Visible] / stats.started[Render::Visible])
+			.arg(stats.max_wait[Render::Visible]);
+	}
+	text += QString::fromUtf8("cancelled: %1, aborted: %2\n")
+		.arg(stats.cancelled)
+		.arg(stats.aborted);
+	text += QString::fromUtf8("cache: %1 MiB")
+		.arg(res->get_cache_size() / 1024 / 1024);
+
+	hud->setText(text);
+	hud->adjustSize();
+	hud->move(width() - hud->width(), page_overlay->y() - hud->height());
+}
+
 void Canvas::focus_goto() {
 	goto_line->activateWindow();
 	goto_line->show();
@@ -456,6 +510,13 @@ void Canvas::page_rendered(int page) {
 	}
 }
 
+void Canvas::page_sizes_changed(int first, int last) {
+	single_layout->update_page_sizes(first, last);
+	grid_layout->update_page_sizes(first, last);
+	presenter_layout->update_page_sizes(first, last);
+	update();
+}
+
 void Canvas::goto_page() {
 	int page = goto_line->text().toInt() - 1;
 	goto_line->hide();
@@ -55,6 +55,7 @@ signals:
 
 private slots:
 	void page_rendered(int page);
+	void page_sizes_changed(int first, int last);
 	void goto_page();
 
 	// primitive actions
@@ -63,6 +64,8 @@ private slots:
 	void set_presenter_layout();
 
 	void toggle_overlay();
+	void toggle_hud();
+	void update_hud();
 	void focus_goto();
 
 	void disable_triple_click();
@@ -81,6 +84,8 @@ private:
 
 	GotoLine *goto_line;
 	QLabel *page_overlay;
+	QLabel *hud; // timings, above the page overlay
+	QTimer hud_timer;
 
 	int mx, my;
 	int mx_down, my_down;
@@ -74,7 +74,21 @@ void CFG::init_defaults() {
 	default_setting("Settings/inverted_color_brightening", 0.15);
 	default_setting("Settings/mouse_wheel_factor", 120); // (qt-)delta for turning the mouse wheel 1 click
 	default_setting("Settings/thumbnail_filter", true); // filter when creating thumbnail image
-	default_setting("Settings/thumbnail_size", 32);
+	default_setting("Settings/thumbnail_size", 32); // 0: disable thumbnails
+	default_setting("Settings/thumbnail_threads", 1); // 0: one per cpu core
+	default_setting("Settings/render_threads", 0); // 0: one per cpu core
+	default_setting("Settings/render_deadline", 200); // ms, 0: disable
+	default_setting("Settings/search_threads", 2); // 0: one per cpu core
+	default_setting("Settings/search_index", true);
+	default_setting("Settings/preview_scale", 0.25); // 0: disable previews
+	default_setting("Settings/resize_settle_time", 250); // ms, 0: always render the exact size
+	default_setting("Settings/tile_size", 512);
+	default_setting("Settings/tile_threshold", 32); // megapixels, 0: disable tiles
+	default_setting("Settings/cache_size", 512); // MiB
+	default_setting("Settings/disk_cache", false);
+	default_setting("Settings/disk_cache_size", 1024); // MiB
+	default_setting("Settings/trace_file", ""); // empty: disable tracing
+	default_setting("Settings/download_timeout", 30); // s, 0: wait forever
 
 	// keys
 	// movement
@@ -115,6 +129,7 @@ void CFG::init_defaults() {
 	default_key("Keys/rotate_right", ".");
 	// viewer
 	default_key("Keys/toggle_overlay", "T");
+	default_key("Keys/toggle_hud", "F12");
 	default_key("Keys/quit", "Q", "W,E,E,E");
 	default_key("Keys/close_search", "Esc");
 	default_key("Keys/invert_colors", "I");
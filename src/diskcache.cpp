@@ -0,0 +1,177 @@
+#include "diskcache.h"
+#include "config.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDirIterator>
+#include <QCryptographicHash>
+#include <QThread>
+#if QT_VERSION >= 0x050000
+#	include <QStandardPaths>
+#else
+#	include <QDesktopServices>
+#endif
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <sys/stat.h>
+#include <utime.h>
+
+using namespace std;
+
+
+// only hash the beginning and the end, the end of a pdf contains the
+// cross-reference table which changes with almost every modification;
+// edits in the middle are caught by the modification time and inode
+static const qint64 hash_chunk_size = 1024 * 1024;
+
+
+DiskCache::DiskCache() {
+	// load config options
+	CFG *config = CFG::get_instance();
+	enabled = config->get_value("Settings/disk_cache").toBool();
+	size_limit = config->get_value("Settings/disk_cache_size").toLongLong() * 1024 * 1024;
+
+#if QT_VERSION >= 0x050000
+	base_dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+#else
+	base_dir = QDesktopServices::storageLocation(QDesktopServices::CacheLocation);
+#endif
+	base_dir += QString::fromUtf8("/pages");
+}
+
+void DiskCache::open(const QString &file) {
+	dir = QString();
+	if (!enabled || file.isEmpty()) {
+		return;
+	}
+
+	QFile f(file);
+	if (!f.open(QIODevice::ReadOnly)) {
+		return;
+	}
+	struct stat st;
+	if (fstat(f.handle(), &st) != 0) {
+		return;
+	}
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(QByteArray::number(f.size()));
+	hash.addData(QByteArray::number((qint64) st.st_mtime));
+	hash.addData(QByteArray::number((quint64) st.st_ino));
+	hash.addData(QByteArray::number((quint64) st.st_dev));
+	hash.addData(f.read(hash_chunk_size));
+	if (f.size() > hash_chunk_size) {
+		f.seek(max(hash_chunk_size, f.size() - hash_chunk_size));
+		hash.addData(f.read(hash_chunk_size));
+	}
+	f.close();
+
+	QString path = base_dir + QString::fromUtf8("/") + QString::fromLatin1(hash.result().toHex().constData());
+	if (!QDir().mkpath(path)) {
+		cerr << "failed to create cache directory " << path.toUtf8().constData() << endl;
+		return;
+	}
+	dir = path;
+}
+
+void DiskCache::close() {
+	dir = QString();
+}
+
+bool DiskCache::is_enabled() const {
+	return !dir.isEmpty();
+}
+
+QImage DiskCache::load(int page, int width, int rotation) const {
+	if (!is_enabled()) {
+		return QImage();
+	}
+	QString path = get_path(page, width, rotation);
+	if (!QFile::exists(path)) {
+		return QImage();
+	}
+	QImage img(path, "PNG");
+	if (img.isNull()) {
+		return img;
+	}
+	// prune() goes by the modification time, atime is often not updated
+	utime(QFile::encodeName(path).constData(), NULL);
+	// invert_image works on 32 bit pixels
+	if (img.depth() != 32) {
+		img = img.convertToFormat(QImage::Format_ARGB32);
+	}
+	return img;
+}
+
+void DiskCache::store(int page, int width, int rotation, const QImage &img) const {
+	if (!is_enabled()) {
+		return;
+	}
+	// write to a temporary file first, other threads might be reading
+	QString path = get_path(page, width, rotation);
+	QString tmp = path + QString::fromUtf8(".%1.tmp")
+		.arg(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+	// low compression, saving is done by the render threads
+	if (!img.save(tmp, "PNG", 90)) {
+		QFile::remove(tmp);
+		return;
+	}
+	QFile::remove(path);
+	if (!QFile::rename(tmp, path)) {
+		QFile::remove(tmp);
+	}
+}
+
+// files are touched when they are loaded
+static bool file_less_recent(const QFileInfo &a, const QFileInfo &b) {
+	return a.lastModified() < b.lastModified();
+}
+
+void DiskCache::prune() const {
+	if (!is_enabled()) {
+		return;
+	}
+	vector<QFileInfo> files;
+	qint64 total = 0;
+	QDirIterator it(base_dir, QDir::Files, QDirIterator::Subdirectories);
+	while (it.hasNext()) {
+		it.next();
+		files.push_back(it.fileInfo());
+		total += it.fileInfo().size();
+	}
+	if (total <= size_limit) {
+		return;
+	}
+
+	sort(files.begin(), files.end(), file_less_recent);
+	for (vector<QFileInfo>::iterator f = files.begin(); f != files.end() && total > size_limit; ++f) {
+		if (QFile::remove(f->filePath())) {
+			total -= f->size();
+		}
+	}
+	// clean up empty directories of other documents
+	QDir base(base_dir);
+	QStringList dirs = base.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+	Q_FOREACH(const QString &d, dirs) {
+		base.rmdir(d); // fails if not empty
+	}
+}
+
+QString DiskCache::get_index_path() const {
+	if (!is_enabled()) {
+		return QString();
+	}
+	QString path = dir + QString::fromUtf8("/index");
+	// counts as a use for prune(), like loading a page
+	utime(QFile::encodeName(path).constData(), NULL);
+	return path;
+}
+
+QString DiskCache::get_path(int page, int width, int rotation) const {
+	return QString::fromUtf8("%1/%2-%3-%4.png")
+		.arg(dir)
+		.arg(page)
+		.arg(width)
+		.arg(rotation);
+}
+
@@ -0,0 +1,39 @@
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include <QString>
+#include <QImage>
+
+
+// rendered pages stored in the user's cache directory
+class DiskCache {
+public:
+	DiskCache();
+
+	void open(const QString &file);
+	void close();
+	bool is_enabled() const;
+
+	QImage load(int page, int width, int rotation) const;
+	void store(int page, int width, int rotation, const QImage &img) const;
+
+	// removes the least recently used files above the size limit
+	void prune() const;
+
+	// where to keep the search index of the document, empty when disabled;
+	// marks an existing index as recently used
+	QString get_index_path() const;
+
+private:
+	QString get_path(int page, int width, int rotation) const;
+
+	QString base_dir;
+	QString dir; // for the current document, empty when disabled
+
+	// config options
+	bool enabled;
+	qint64 size_limit; // bytes
+};
+
+#endif
+
@@ -0,0 +1,69 @@
+#include "documentpool.h"
+#include "util.h"
+#include <iostream>
+#include <algorithm>
+#if QT_VERSION >= 0x050000
+#	include <poppler-qt5.h>
+#else
+#	include <poppler-qt4.h>
+#endif
+
+using namespace std;
+
+
+DocumentPool::DocumentPool(const QString &file, const QByteArray &password, int limit) :
+		file(file),
+		password(password),
+		count(0),
+		limit(max(1, limit)) {
+}
+
+DocumentPool::~DocumentPool() {
+#ifdef DEBUG
+	if ((int) idle.size() != count) {
+		cerr << count - idle.size() << " documents were not released" << endl;
+	}
+	cerr << "opened " << count << " copies of the document" << endl;
+#endif
+	for (vector<Poppler::Document *>::iterator it = idle.begin(); it != idle.end(); ++it) {
+		delete *it;
+	}
+}
+
+Poppler::Document *DocumentPool::acquire() {
+	mutex.lock();
+	// every copy holds the document's caches, huge files don't fit many times
+	while (idle.empty() && count >= limit) {
+		released.wait(&mutex);
+	}
+	if (!idle.empty()) {
+		Poppler::Document *doc = idle.back();
+		idle.pop_back();
+		mutex.unlock();
+		return doc;
+	}
+	count++;
+	mutex.unlock();
+
+	// opening takes long, don't block the other threads
+	Poppler::Document *doc = Poppler::Document::load(file, QByteArray(), password);
+	if (doc == NULL || doc->isLocked()) {
+		cerr << "failed to open another copy of the document" << endl;
+		delete doc;
+		mutex.lock();
+		count--;
+		released.wakeOne();
+		mutex.unlock();
+		return NULL;
+	}
+	set_render_hints(doc);
+	return doc;
+}
+
+void DocumentPool::release(Poppler::Document *doc) {
+	mutex.lock();
+	idle.push_back(doc);
+	released.wakeOne();
+	mutex.unlock();
+}
+
@@ -0,0 +1,43 @@
+#ifndef DOCUMENTPOOL_H
+#define DOCUMENTPOOL_H
+
+#include <QString>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+#include <vector>
+
+
+namespace Poppler {
+	class Document;
+}
+
+
+// copies of one document for the worker threads; poppler documents must
+// not be used by two threads at once, so threads borrow a copy per job.
+// render, thumbnail, text and search threads share the same copies, only
+// as many are opened as are in use at the same time, up to limit
+class DocumentPool {
+public:
+	DocumentPool(const QString &file, const QByteArray &password, int limit);
+	// all documents must have been released
+	~DocumentPool();
+
+	// opens another copy if none is free, blocks while limit copies are in
+	// use; NULL if opening fails
+	Poppler::Document *acquire();
+	void release(Poppler::Document *doc);
+
+private:
+	QString file;
+	QByteArray password;
+
+	QMutex mutex;
+	QWaitCondition released;
+	std::vector<Poppler::Document *> idle;
+	int count; // opened copies, including the ones being opened
+	int limit;
+};
+
+#endif
+
@@ -1,9 +1,8 @@
 #include "download.h"
+#include "config.h"
 #include <iostream>
 #include <QEventLoop>
-#include <QUrl>
 #include <QNetworkRequest>
-#include <QNetworkReply>
 #include <QByteArray>
 #include <QDir>
 #include <QFileInfo>
@@ -11,12 +10,25 @@
 using namespace std;
 
 
+// the reply never holds more than this in memory
+static const qint64 chunk_size = 256 * 1024;
+// how often an interrupted download is resumed
+static const int max_retries = 3;
+
+
 Download::Download() :
 	manager(new QNetworkAccessManager()),
-	file(NULL) {
+	file(NULL),
+	reply(NULL),
+	offset(0),
+	accept_ranges(false) {
+	timeout = CFG::get_instance()->get_value("Settings/download_timeout").toInt();
+	stall_timer.setSingleShot(true);
+	connect(&stall_timer, SIGNAL(timeout()), this, SLOT(stalled()));
 }
 
 Download::~Download() {
+	delete reply;
 	delete manager;
 	delete file;
 }
@@ -28,32 +40,56 @@ QString Download::load(QString f) {
 		return QDir::toNativeSeparators(url.toLocalFile());
 	}
 
-	QEventLoop loop;
-	QObject::connect(manager, SIGNAL(finished(QNetworkReply *)), &loop, SLOT(quit()));
-	QNetworkReply *reply = manager->get(QNetworkRequest(url));
-	QObject::connect(reply, SIGNAL(downloadProgress(qint64, qint64)), this, SLOT(progress(qint64, qint64)));
-	loop.exec();
-#ifdef DEBUG
-	cerr << "File downloaded" << endl;
-#endif
-
 	// find unique temporary filename
 	QFileInfo fileInfo(url.path());
 	QString fileName = fileInfo.fileName();
 	delete file;
 	file = new QTemporaryFile(QDir::tempPath() + QDir::separator() + fileName);
 	file->setAutoRemove(true);
-	file->open();
-
-	if (reply->error() != QNetworkReply::NoError || !reply->isReadable()) {
-		cerr << reply->errorString().toStdString() << endl;
+	if (!file->open()) {
+		cerr << "failed to create temporary file: " << file->errorString().toStdString() << endl;
 		return QString();
 	}
 
-	// store data in tempfile
-	QByteArray data = reply->readAll();
-	reply->deleteLater();
-	file->write(data);
+	// data is written as it arrives, an interrupted download continues where it stopped
+	QNetworkReply::NetworkError error = QNetworkReply::NoError;
+	QString error_string;
+	accept_ranges = false;
+	for (int attempt = 0; attempt <= max_retries; attempt++) {
+		if (attempt > 0) {
+			if (!accept_ranges || file->size() == 0) {
+				break;
+			}
+			cerr << endl << error_string.toStdString() << ", resuming at " << file->size() << " bytes" << endl;
+		}
+
+		QEventLoop loop;
+		request(url);
+		connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+		loop.exec();
+		stall_timer.stop();
+		write_data();
+
+		error = reply->error();
+		error_string = reply->errorString();
+		if (reply->rawHeader("Accept-Ranges") == "bytes" ||
+				reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 206) {
+			accept_ranges = true;
+		}
+		reply->deleteLater();
+		reply = NULL;
+		if (error == QNetworkReply::NoError) {
+			break;
+		}
+	}
+#ifdef DEBUG
+	cerr << "File downloaded" << endl;
+#endif
+
+	if (error != QNetworkReply::NoError || !file->flush()) {
+		cerr << endl << error_string.toStdString() << endl;
+		return QString();
+	}
 	file->close();
 #ifdef DEBUG
 	cerr << "filename: " << file->fileName().toStdString() << endl;
@@ -61,9 +97,57 @@ QString Download::load(QString f) {
 	return file->fileName();
 }
 
+void Download::request(const QUrl &url) {
+	QNetworkRequest req(url);
+	offset = file->size();
+	if (offset > 0) {
+		req.setRawHeader("Range", "bytes=" + QByteArray::number(offset) + "-");
+	}
+	reply = manager->get(req);
+	reply->setReadBufferSize(chunk_size);
+	connect(reply, SIGNAL(readyRead()), this, SLOT(write_data()));
+	connect(reply, SIGNAL(downloadProgress(qint64, qint64)), this, SLOT(progress(qint64, qint64)));
+	if (timeout > 0) {
+		stall_timer.start(timeout * 1000);
+	}
+}
+
+void Download::write_data() {
+	if (reply == NULL) {
+		return;
+	}
+	if (timeout > 0) {
+		stall_timer.start(timeout * 1000);
+	}
+	// the server ignored the range and sends everything again
+	if (offset > 0 && reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 200) {
+		file->resize(0);
+		file->seek(0);
+		offset = 0;
+	}
+	while (reply->bytesAvailable() > 0) {
+		QByteArray data = reply->read(chunk_size);
+		if (file->write(data) != data.size()) {
+			cerr << "failed to write temporary file: " << file->errorString().toStdString() << endl;
+			reply->abort();
+			return;
+		}
+	}
+}
+
+void Download::stalled() {
+	if (reply != NULL) {
+		cerr << endl << "no data received for " << timeout << "s" << endl;
+		reply->abort();
+	}
+}
+
 void Download::progress(qint64 bytes_received, qint64 bytes_total) {
+	if (bytes_total >= 0) {
+		bytes_total += offset;
+	}
 	cout.precision(1);
-	cout << fixed << (bytes_received / 1024.0f) << "/";
+	cout << fixed << ((offset + bytes_received) / 1024.0f) << "/";
 	cout << (bytes_total / 1024.0f) << "KB downloaded\r";
 }
 
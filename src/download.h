@@ -3,9 +3,13 @@
 
 #include <QString>
 #include <QNetworkAccessManager>
+#include <QNetworkReply>
 #include <QTemporaryFile>
+#include <QTimer>
+#include <QUrl>
 
 
+// streams a remote document into a temporary file
 class Download : public QObject {
 	Q_OBJECT
 
@@ -17,10 +21,23 @@ public:
 
 private slots:
 	void progress(qint64 bytes_received, qint64 bytes_total);
+	void write_data();
+	void stalled();
 
 private:
+	// resumes at the end of the file if the server allows it
+	void request(const QUrl &url);
+
 	QNetworkAccessManager *manager;
 	QTemporaryFile *file;
+	QNetworkReply *reply;
+	QTimer stall_timer;
+
+	qint64 offset; // where the current reply starts in the file
+	bool accept_ranges;
+
+	// config options
+	int timeout; // s
 };
 
 #endif
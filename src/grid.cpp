@@ -1,10 +1,78 @@
 #include "grid.h"
 #include "resourcemanager.h"
+#include "util.h"
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 
 
+//==[ PrefixSums ]=============================================================
+PrefixSums::PrefixSums() :
+		tree(NULL),
+		size(0),
+		top_step(0) {
+}
+
+PrefixSums::~PrefixSums() {
+	delete[] tree;
+}
+
+void PrefixSums::assign(const float *values, int count) {
+	delete[] tree;
+	size = count;
+	tree = new double[size + 1];
+	tree[0] = 0;
+	for (int i = 1; i <= size; i++) {
+		tree[i] = max(values[i - 1], 0.0f);
+	}
+	// linear construction, every node passes its sum on to its parent
+	for (int i = 1; i <= size; i++) {
+		int parent = i + (i & -i);
+		if (parent <= size) {
+			tree[parent] += tree[i];
+		}
+	}
+	top_step = 1;
+	while (top_step * 2 <= size) {
+		top_step *= 2;
+	}
+}
+
+void PrefixSums::add(int index, double delta) {
+	for (int i = index + 1; i <= size; i += i & -i) {
+		tree[i] += delta;
+	}
+}
+
+double PrefixSums::get_sum(int count) const {
+	double sum = 0;
+	for (int i = min(count, size); i > 0; i -= i & -i) {
+		sum += tree[i];
+	}
+	return sum;
+}
+
+int PrefixSums::find(float scale, int gap, int pos) const {
+	// descend the tree, the position only grows with count
+	int count = 0;
+	double sum = 0;
+	for (int step = top_step; step > 0; step /= 2) {
+		int next = count + step;
+		if (next > size) {
+			continue;
+		}
+		double next_sum = sum + tree[next];
+		if ((int) ROUND(next_sum * scale) + next * gap <= pos) {
+			count = next;
+			sum = next_sum;
+		}
+	}
+	return count;
+}
+
+
+//==[ Grid ]===================================================================
 Grid::Grid(ResourceManager *_res, int columns, int offset) :
 		res(_res),
 		column_count(-1),
@@ -28,9 +96,14 @@ bool Grid::set_columns(int columns) {
 		column_count = 1;
 	}
 
-	set_offset(page_offset);
-
-	return old_column_count != column_count;
+	if (old_column_count == column_count) {
+		return false;
+	}
+	// the offset may have to be clamped, which rebuilds the cells
+	if (!set_offset(page_offset)) {
+		rebuild_cells();
+	}
+	return true;
 }
 
 bool Grid::set_offset(int offset) {
@@ -43,8 +116,11 @@ bool Grid::set_offset(int offset) {
 		page_offset = column_count - 1;
 	}
 
+	if (old_page_offset == page_offset) {
+		return false;
+	}
 	rebuild_cells();
-	return old_page_offset != page_offset;
+	return true;
 }
 
 float Grid::get_width(int col) const {
@@ -77,6 +153,28 @@ int Grid::get_offset() const {
 	return page_offset;
 }
 
+double Grid::get_width_sum(int col) const {
+	if (col <= 0) {
+		return 0;
+	}
+	return width_sums.get_sum(col);
+}
+
+double Grid::get_height_sum(int row) const {
+	if (row <= 0) {
+		return 0;
+	}
+	return height_sums.get_sum(row);
+}
+
+int Grid::get_column_at(float size, int gap, int pos) const {
+	return min(width_sums.find(size, gap, pos), column_count - 1);
+}
+
+int Grid::get_row_at(float size, int gap, int pos) const {
+	return max(min(height_sums.find(size, gap, pos), row_count - 1), 0);
+}
+
 void Grid::rebuild_cells() {
 	delete[] width;
 	delete[] height;
@@ -95,20 +193,67 @@ void Grid::rebuild_cells() {
 	}
 
 	for (int i = 0; i < res->get_page_count(); i++) {
-		int col = ((i + page_offset) % column_count);
-		int row = ((i + page_offset) / column_count);
+		add_page(i);
+	}
 
-		// calculate column width
-		float new_width = res->get_page_width(i);
-		if (width[col] < 0 || width[col] < new_width) {
-			width[col] = new_width;
-		}
+	width_sums.assign(width, column_count);
+	height_sums.assign(height, row_count);
+}
+
+void Grid::update_pages(int first, int last) {
+	if (first <= 0 && last >= res->get_page_count() - 1) {
+		rebuild_cells();
+		return;
+	}
 
-		// calculate row height
-		float new_height = res->get_page_height(i);
-		if (height[row] < 0 || height[row] < new_height) {
-			height[row] = new_height;
+	// affected rows are recalculated, columns can only grow
+	// (pages that got narrower are accounted for by the next full rebuild)
+	int row_first = (first + page_offset) / column_count;
+	int row_last = (last + page_offset) / column_count;
+	float *old_height = new float[row_last - row_first + 1];
+	for (int i = row_first; i <= row_last; i++) {
+		old_height[i - row_first] = height[i];
+		height[i] = -1.0f;
+	}
+	float *old_width = new float[column_count];
+	copy(width, width + column_count, old_width);
+
+	int page_first = max(row_first * column_count - page_offset, 0);
+	int page_last = min((row_last + 1) * column_count - page_offset, res->get_page_count()) - 1;
+	for (int i = page_first; i <= page_last; i++) {
+		add_page(i);
+	}
+
+	// only the changes go into the sums
+	for (int i = row_first; i <= row_last; i++) {
+		float delta = max(height[i], 0.0f) - max(old_height[i - row_first], 0.0f);
+		if (delta != 0) {
+			height_sums.add(i, delta);
 		}
 	}
+	for (int i = 0; i < column_count; i++) {
+		float delta = max(width[i], 0.0f) - max(old_width[i], 0.0f);
+		if (delta != 0) {
+			width_sums.add(i, delta);
+		}
+	}
+	delete[] old_height;
+	delete[] old_width;
 }
 
+void Grid::add_page(int page) {
+	int col = ((page + page_offset) % column_count);
+	int row = ((page + page_offset) / column_count);
+
+	// calculate column width
+	float new_width = res->get_page_width(page);
+	if (width[col] < 0 || width[col] < new_width) {
+		width[col] = new_width;
+	}
+
+	// calculate row height
+	float new_height = res->get_page_height(page);
+	if (height[row] < 0 || height[row] < new_height) {
+		height[row] = new_height;
+	}
+}
@@ -5,6 +5,30 @@
 class ResourceManager;
 
 
+// Fenwick tree over the row heights or column widths of a grid, positions
+// are looked up and updated in O(log n)
+class PrefixSums {
+public:
+	PrefixSums();
+	~PrefixSums();
+
+	// replaces all values, negative ones count as 0
+	void assign(const float *values, int count);
+	void add(int index, double delta);
+
+	// sum of the values [0, count)
+	double get_sum(int count) const;
+	// the largest count in [0, size] with
+	// (int) ROUND(get_sum(count) * scale) + count * gap <= pos
+	int find(float scale, int gap, int pos) const;
+
+private:
+	double *tree; // 1-based
+	int size;
+	int top_step; // largest power of two <= size
+};
+
+
 class Grid {
 public:
 	Grid(ResourceManager *_res, int columns, int offset);
@@ -12,6 +36,8 @@ public:
 
 	bool set_columns(int columns);
 	bool set_offset(int offset);
+	// the sizes of pages [first, last] changed
+	void update_pages(int first, int last);
 
 	float get_width(int col) const;
 	float get_height(int row) const;
@@ -19,8 +45,17 @@ public:
 	int get_row_count() const;
 	int get_offset() const;
 
+	// summed widths of the columns [0, col) and heights of the rows [0, row)
+	double get_width_sum(int col) const;
+	double get_height_sum(int row) const;
+	// the column/row whose scaled position is at or before pos, with
+	// gap pixels between neighbours
+	int get_column_at(float size, int gap, int pos) const;
+	int get_row_at(float size, int gap, int pos) const;
+
 private:
 	void rebuild_cells();
+	void add_page(int page);
 
 	ResourceManager *res;
 
@@ -28,6 +63,8 @@ private:
 	int row_count;
 	float *width;
 	float *height;
+	PrefixSums width_sums;
+	PrefixSums height_sums;
 	int page_offset;
 };
 
@@ -1,14 +1,36 @@
 #include "kpage.h"
 #include <QList>
-#include "selection.h"
+#include "textlayout.h"
 
 using namespace std;
 
+
+TileKey::TileKey(int width, char rotation, int col, int row) :
+		width(width),
+		rotation(rotation),
+		col(col),
+		row(row) {
+}
+
+bool TileKey::operator<(const TileKey &other) const {
+	if (width != other.width) {
+		return width < other.width;
+	}
+	if (rotation != other.rotation) {
+		return rotation < other.rotation;
+	}
+	if (row != other.row) {
+		return row < other.row;
+	}
+	return col < other.col;
+}
+
+
 KPage::KPage() :
 		links(NULL),
 		inverted_colors(false),
 		text(NULL) {
-	for (int i = 0; i < 3; i++) {
+	for (int i = 0; i < render_index_count; i++) {
 		status[i] = 0;
 		rotation[i] = 0;
 	}
@@ -21,19 +43,14 @@ KPage::~KPage() {
 		}
 	}
 	delete links;
-	if (text != NULL) {
-		Q_FOREACH(SelectionLine *line, *text) {
-			delete line;
-		}
-	}
 	delete text;
 }
 
 const QImage *KPage::get_image(int index) const {
 	// return any available image, try the right index first
-	for (int i = 3; i > 0; i--) {
-		if (!img[(index + i) % 3].isNull()) {
-			return &img[(index + i) % 3];
+	for (int i = render_index_count; i > 0; i--) {
+		if (!img[(index + i) % render_index_count].isNull()) {
+			return &img[(index + i) % render_index_count];
 		}
 	}
 	if (thumbnail.isNull()) {
@@ -43,6 +60,19 @@ const QImage *KPage::get_image(int index) const {
 	}
 }
 
+int KPage::get_slot(int index, int width, char rotation) const {
+	if (!img[index].isNull() && status[index] == width && this->rotation[index] == rotation) {
+		return index;
+	}
+	for (int i = 0; i < render_index_count; i++) {
+		if (i != index && !img[i].isNull() && this->rotation[i] == rotation &&
+				status[i] >= width && status[i] <= width * max_share_scale) {
+			return i;
+		}
+	}
+	return index;
+}
+
 int KPage::get_width(int index) const {
 	// status might contain the information for img_other, but no inverted version is available yet
 	if (img[index].isNull()) {
@@ -54,28 +84,37 @@ int KPage::get_width(int index) const {
 
 char KPage::get_rotation(int index) const {
 	// return rotation of next available image, try the right index first
-	for (int i = 3; i > 0; i--) {
-		if (!img[(index + i) % 3].isNull()) {
-			return rotation[(index + i) % 3];
+	for (int i = render_index_count; i > 0; i--) {
+		if (!img[(index + i) % render_index_count].isNull()) {
+			return rotation[(index + i) % render_index_count];
 		}
 	}
 	// no image available? use thumbnail (always 0)
 	return 0;
 }
 
-const QList<SelectionLine *> *KPage::get_text() const {
+const TextLayout *KPage::get_text() const {
 	return text;
 }
 
+const QImage *KPage::get_tile(const TileKey &key) const {
+	map<TileKey,QImage>::const_iterator it = tiles.find(key);
+	if (it == tiles.end()) {
+		return NULL;
+	}
+	return &it->second;
+}
+
 //QString KPage::get_label() const {
 //	return label;
 //}
 
 void KPage::toggle_invert_colors() {
-	for (int i = 0; i < 3; i++) {
+	for (int i = 0; i < render_index_count; i++) {
 		img[i].swap(img_other[i]);
 	}
 	thumbnail.swap(thumbnail_other);
+	tiles.swap(tiles_other);
 	inverted_colors = !inverted_colors;
 }
 
@@ -3,6 +3,7 @@
 
 #include <QImage>
 #include <QMutex>
+#include <map>
 #if QT_VERSION >= 0x050000
 #	include <poppler-qt5.h>
 #else
@@ -10,7 +11,27 @@
 #endif
 
 
-class SelectionLine;
+class TextLayout;
+
+
+// image slots of a page, one per view: the main view, the presenter
+// layout's current and next slide and the beamer window
+const int render_index_count = 4;
+// a view draws another view's image of a page if it is at most this much larger
+const float max_share_scale = 2.0f;
+
+
+class TileKey {
+public:
+	TileKey(int width, char rotation, int col, int row);
+
+	bool operator<(const TileKey &other) const;
+
+	int width; // of the whole page
+	char rotation;
+	int col;
+	int row;
+};
 
 
 class KPage {
@@ -20,9 +41,13 @@ private:
 
 public:
 	const QImage *get_image(int index = 0) const;
+	// the slot to draw index's image at width from; another view's image is
+	// used if it has the right rotation and can be scaled down
+	int get_slot(int index, int width, char rotation) const;
 	int get_width(int index = 0) const;
 	char get_rotation(int index = 0) const;
-	const QList<SelectionLine *> *get_text() const;
+	const TextLayout *get_text() const;
+	const QImage *get_tile(const TileKey &key) const;
 //	QString get_label() const;
 
 private:
@@ -30,23 +55,27 @@ private:
 
 	float width;
 	float height;
-	QImage img[3];
-	QImage thumbnail;
+	QImage img[render_index_count];
+	QImage thumbnail; // a view into the ThumbnailAtlas
 	// for inverted colors with reduced contrast
 	// img_other contain the currently not needed color versions
 	// img store the current versions to be displayed
-	QImage img_other[3];
+	QImage img_other[render_index_count];
 	QImage thumbnail_other;
+	// parts of pages too big to be rendered as a whole
+	std::map<TileKey,QImage> tiles;
+	std::map<TileKey,QImage> tiles_other;
 
 //	QString label;
 	QList<Poppler::Link *> *links;
 	QMutex mutex;
-	int status[3];
-	char rotation[3];
+	int status[render_index_count];
+	char rotation[render_index_count];
 	bool inverted_colors; // img[]s and thumb must be consistent
-	QList<SelectionLine *> *text;
+	TextLayout *text;
 
 	friend class Worker;
+	friend class TextWorker;
 	friend class ResourceManager;
 };
 
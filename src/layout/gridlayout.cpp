@@ -1,4 +1,5 @@
 #include <iostream>
+#include <algorithm>
 #include <QImage>
 #include <QApplication>
 #include "gridlayout.h"
@@ -55,10 +56,7 @@ void GridLayout::set_constants(bool clamp) {
 	}
 
 	// calculate fit
-	float used = 0;
-	for (int i = 0; i < grid->get_column_count(); i++) {
-		used += grid->get_width(i);
-	}
+	float used = grid->get_width_sum(grid->get_column_count());
 	int available = width - useless_gap * (grid->get_column_count() - 1);
 	if (available < min_page_width * grid->get_column_count()) {
 		available = min_page_width * grid->get_column_count();
@@ -71,41 +69,21 @@ void GridLayout::set_constants(bool clamp) {
 	horizontal_page = (page + horizontal_page) % grid->get_column_count();
 	page = page / grid->get_column_count() * grid->get_column_count();
 
-	total_height = 0;
-	for (int i = 0; i < grid->get_row_count(); i++) {
-		total_height += ROUND(grid->get_height(i) * size);
-	}
-	total_height += useless_gap * (grid->get_row_count() - 1);
-
-	total_width = 0;
-	for (int i = 0; i < grid->get_column_count(); i++) {
-		total_width += grid->get_width(i) * size;
-	}
-	total_width += useless_gap * (grid->get_column_count() - 1);
+	total_height = get_row_position(grid->get_row_count()) - useless_gap;
+	total_width = get_column_position(grid->get_column_count()) - useless_gap;
 
 	// calculate offset for blocking at the right border
 	border_page_w = grid->get_column_count();
-	int w = 0;
-	for (int i = grid->get_column_count() - 1; i >= 0; i--) {
-		w += grid->get_width(i) * size;
-		if (w >= width) {
-			border_page_w = i;
-			border_off_w = width - w;
-			break;
-		}
-		w += useless_gap;
+	if (total_width >= width) {
+		border_page_w = grid->get_column_at(size, useless_gap, total_width - width);
+		border_off_w = get_column_position(border_page_w) - (total_width - width);
 	}
 	// bottom border
 	border_page_h = grid->get_row_count() * grid->get_column_count();
-	int h = 0;
-	for (int i = grid->get_row_count() - 1; i >= 0; i--) {
-		h += ROUND(grid->get_height(i) * size);
-		if (h >= height) {
-			border_page_h = i * grid->get_column_count();
-			border_off_h = height - h;
-			break;
-		}
-		h += useless_gap;
+	if (total_height >= height) {
+		int row = grid->get_row_at(size, useless_gap, total_height - height);
+		border_page_h = row * grid->get_column_count();
+		border_off_h = get_row_position(row) - (total_height - height);
 	}
 
 	// update view
@@ -140,6 +118,11 @@ void GridLayout::resize(int w, int h) {
 	scroll_smooth_noupdate(0, 0);
 }
 
+void GridLayout::update_page_sizes(int first, int last) {
+	grid->update_pages(first, last);
+	set_constants();
+}
+
 void GridLayout::set_zoom(int new_zoom, bool relative) {
 	float old_factor = 1 + zoom * zoom_factor;
 	int old_page = get_page();
@@ -162,6 +145,7 @@ void GridLayout::set_zoom(int new_zoom, bool relative) {
 	off_x = (off_x - width / 2) * new_factor / old_factor + width / 2;
 	off_y = (off_y - height / 2) * new_factor / old_factor + height / 2;
 
+	res->begin_resize(render_index);
 	set_constants();
 	viewer->layout_updated(get_page(), get_page() != old_page);
 }
@@ -209,28 +193,12 @@ bool GridLayout::scroll_smooth_noupdate(int dx, int dy) {
 		page = 0;
 		off_y = (height - total_height) / 2;
 	} else {
-		int h; // implicit rounding
-		// page up
-		while (off_y > 0 &&
-				(h = ROUND(grid->get_height(page / grid->get_column_count() - 1) * size)) > 0) {
-			off_y -= h + useless_gap;
-			page -= grid->get_column_count();
-		}
-		// page down
-		while ((h = ROUND(grid->get_height(page / grid->get_column_count()) * size)) > 0 &&
-				page < border_page_h &&
-				off_y <= -h - useless_gap) {
-			off_y += h + useless_gap;
-			page += grid->get_column_count();
-		}
-		// top and bottom borders
-		if (page == 0 && off_y > 0) {
-			off_y = 0;
-		} else if ((page == border_page_h && off_y < border_off_h) ||
-				page > border_page_h) {
-			page = border_page_h;
-			off_y = border_off_h;
-		}
+		// position of the viewport's top edge, clamped to the top and bottom borders
+		int y = get_row_position(page / grid->get_column_count()) - off_y;
+		y = max(0, min(y, total_height - height));
+		int row = grid->get_row_at(size, useless_gap, y);
+		page = row * grid->get_column_count();
+		off_y = get_row_position(row) - y;
 	}
 
 	// horizontal scrolling
@@ -238,29 +206,11 @@ bool GridLayout::scroll_smooth_noupdate(int dx, int dy) {
 		horizontal_page = 0;
 		off_x = (width - total_width) / 2;
 	} else {
-		int w; // implicit rounding
-		// page left
-		while (off_x > 0 &&
-				(w = grid->get_width(horizontal_page - 1) * size) > 0) {
-			off_x -= w + useless_gap;
-			horizontal_page--;
-		}
-		// page right
-		while ((w = grid->get_width(horizontal_page) * size) > 0 &&
-				horizontal_page < border_page_w &&
-				horizontal_page < grid->get_column_count() - 1 && // only for horizontal
-				off_x <= -w - useless_gap) {
-			off_x += w + useless_gap;
-			horizontal_page++;
-		}
 		// left and right borders
-		if (horizontal_page == 0 && off_x > 0) {
-			off_x = 0;
-		} else if ((horizontal_page == border_page_w && off_x < border_off_w) ||
-				horizontal_page > border_page_w) {
-			horizontal_page = border_page_w;
-			off_x = border_off_w;
-		}
+		int x = get_column_position(horizontal_page) - off_x;
+		x = max(0, min(x, total_width - width));
+		horizontal_page = grid->get_column_at(size, useless_gap, x);
+		off_x = get_column_position(horizontal_page) - x;
 	}
 	return off_x != old_off_x || off_y != old_off_y || get_page() != old_page;
 }
@@ -326,17 +276,7 @@ void GridLayout::scroll_page_top_jump(int new_page, bool relative) {
 	int column_index = (new_page + grid->get_offset()) % grid->get_column_count();
 
 	// calculate pixel offset
-	int offset = 0;
-//	horizontal_page = 0;
-	if (column_index >= horizontal_page) {
-		for (int i = horizontal_page; i < column_index; i++) {
-			offset += grid->get_width(i) * size + useless_gap;
-		}
-	} else {
-		for (int i = horizontal_page; i >= column_index; i--) {
-			offset -= grid->get_width(i) * size + useless_gap;
-		}
-	}
+	int offset = get_column_position(column_index) - get_column_position(horizontal_page);
 
 	// move viewport
 	change |= scroll_smooth_noupdate(-off_x - offset, -off_y);
@@ -352,12 +292,12 @@ void GridLayout::render(QPainter *painter) {
 	int last_page = page + horizontal_page;
 	int grid_height; // implicit rounding
 	int hpos = off_y;
-	while ((grid_height = ROUND(grid->get_height(cur_page / grid->get_column_count()) * size)) > 0 && hpos < height) {
+	while ((grid_height = get_row_height(cur_page / grid->get_column_count())) > 0 && hpos < height) {
 		// horizontal
 		int cur_col = horizontal_page;
 		int grid_width; // implicit rounding
 		int wpos = off_x;
-		while ((grid_width = grid->get_width(cur_col) * size) > 0 &&
+		while ((grid_width = get_column_width(cur_col)) > 0 &&
 				cur_col < grid->get_column_count() &&
 				wpos < width) {
 			last_page = cur_page + cur_col - grid->get_offset();
@@ -370,38 +310,11 @@ void GridLayout::render(QPainter *painter) {
 
 			const KPage *k_page = res->get_page(last_page, page_width, render_index);
 			if (k_page != NULL) {
-				const QImage *img = k_page->get_image();
-				if (img != NULL) {
-					int rot = (res->get_rotation() - k_page->get_rotation() + 4) % 4;
-					QRect rect;
-					painter->rotate(rot * 90);
-					// calculate page position
-					if (rot == 0) {
-						rect = QRect(wpos + center_x, hpos + center_y,
-								page_width, page_height);
-					} else if (rot == 1) {
-						rect = QRect(hpos + center_y, -wpos - center_x - page_width,
-								page_height, page_width);
-					} else if (rot == 2) {
-						rect = QRect(-wpos - center_x - page_width,
-								-hpos - center_y - page_height,
-								page_width, page_height);
-					} else if (rot == 3) {
-						rect = QRect(-hpos - center_y - page_height, wpos + center_x,
-								page_height, page_width);
-					}
-					// draw scaled
-					if (page_width != k_page->get_width() || rot != 0) {
-						painter->drawImage(rect, *img);
-					} else { // draw as-is
-						painter->drawImage(rect.topLeft(), *img);
-					}
-					painter->rotate(-rot * 90);
-				} else {
-					render_blank_page_background(painter, wpos + center_x, hpos + center_y, page_width, page_height);
-				}
+				render_page(painter, last_page, render_index, k_page,
+						QRect(wpos + center_x, hpos + center_y, page_width, page_height));
 				res->unlock_page(last_page);
 			}
+			render_tiles(painter, last_page, QRect(wpos + center_x, hpos + center_y, page_width, page_height));
 
 			// draw search rects
 			QPoint offset(wpos + center_x, hpos + center_y);
@@ -420,21 +333,28 @@ void GridLayout::render(QPainter *painter) {
 	}
 
 	last_visible_page = last_page;
-	res->collect_garbage(page + horizontal_page - grid->get_offset() - prefetch_count * 3, last_page + prefetch_count * 3, render_index);
+	prune_pixmaps();
+	int first_page = page + horizontal_page - grid->get_offset();
+	update_prefetch_window(first_page);
+	res->collect_garbage(first_page - keep_before, last_page + keep_after, render_index, first_page, last_page);
 
 	// prefetch
-	int prefetch_first = page + horizontal_page - grid->get_offset() - 1;
+	int prefetch_first = first_page - 1;
 	int prefetch_last = last_visible_page + 1;
-	for (int count = 0; count < prefetch_count; count++) {
+	for (int count = 0; count < max(prefetch_after, prefetch_before); count++) {
 		// after last visible page
-		int page_width = res->get_page_width(prefetch_last + count) * size;
-		if (res->get_page(prefetch_last + count, page_width, render_index) != NULL) {
-			res->unlock_page(prefetch_last + count);
+		if (count < prefetch_after) {
+			int page_width = res->get_page_width(prefetch_last + count) * size;
+			if (res->get_page(prefetch_last + count, page_width, render_index, get_prefetch_priority(count + 1)) != NULL) {
+				res->unlock_page(prefetch_last + count);
+			}
 		}
 		// before first visible page
-		page_width = res->get_page_width(prefetch_first + count) * size;
-		if (res->get_page(prefetch_first + count, page_width, render_index) != NULL) {
-			res->unlock_page(prefetch_first + count);
+		if (count < prefetch_before) {
+			int page_width = res->get_page_width(prefetch_first - count) * size;
+			if (res->get_page(prefetch_first - count, page_width, render_index, get_prefetch_priority(count + 1)) != NULL) {
+				res->unlock_page(prefetch_first - count);
+			}
 		}
 	}
 }
@@ -519,31 +439,14 @@ QPoint GridLayout::get_target_page_distance(int target_page) const {
 	int page_width = res->get_page_width(target_page) * size;
 	int page_height = ROUND(res->get_page_height(target_page) * size);
 
-	int center_x = (grid->get_width(target_page_offset % grid->get_column_count()) * size - page_width) / 2;
-	int center_y = (ROUND(grid->get_height(target_page_offset / grid->get_column_count()) * size) - page_height) / 2;
+	int target_col = target_page_offset % grid->get_column_count();
+	int target_row = target_page_offset / grid->get_column_count();
 
-	int wpos = off_x;
-	if (target_page_offset % grid->get_column_count() > horizontal_page) {
-		for (int i = horizontal_page; i < target_page_offset % grid->get_column_count(); i++) {
-			wpos += grid->get_width(i) * size + useless_gap;
-		}
-	} else {
-		for (int i = horizontal_page; i > target_page_offset % grid->get_column_count(); i--) {
-			wpos -= grid->get_width(i) * size + useless_gap;
-		}
-	}
-	int hpos = off_y;
-	if (target_page_offset > page) {
-		for (int i = (page + grid->get_offset()) / grid->get_column_count();
-				i < target_page_offset / grid->get_column_count(); i++) {
-			hpos += ROUND(grid->get_height(i) * size) + useless_gap;
-		}
-	} else {
-		for (int i = (page + grid->get_offset()) / grid->get_column_count();
-				i > target_page_offset / grid->get_column_count(); i--) {
-			hpos -= ROUND(grid->get_height(i) * size) + useless_gap;
-		}
-	}
+	int center_x = (get_column_width(target_col) - page_width) / 2;
+	int center_y = (get_row_height(target_row) - page_height) / 2;
+
+	int wpos = off_x + get_column_position(target_col) - get_column_position(horizontal_page);
+	int hpos = off_y + get_row_position(target_row) - get_row_position(page / grid->get_column_count());
 	return QPoint(wpos + center_x, hpos + center_y);
 }
 
@@ -552,7 +455,7 @@ pair<int, QPointF> GridLayout::get_location_at(int mx, int my) const {
 	int cur_page = page;
 	int grid_height;
 	int hpos = off_y;
-	while ((grid_height = ROUND(grid->get_height(cur_page / grid->get_column_count()) * size)) > 0 &&
+	while ((grid_height = get_row_height(cur_page / grid->get_column_count())) > 0 &&
 			hpos < height) {
 		if (my < hpos + grid_height) {
 			break;
@@ -564,7 +467,7 @@ pair<int, QPointF> GridLayout::get_location_at(int mx, int my) const {
 	int cur_col = horizontal_page;
 	int grid_width;
 	int wpos = off_x;
-	while ((grid_width = grid->get_width(cur_col) * size) > 0 &&
+	while ((grid_width = get_column_width(cur_col)) > 0 &&
 			cur_col < grid->get_column_count() &&
 			wpos < width) {
 		if (mx < wpos + grid_width) {
@@ -656,3 +559,26 @@ bool GridLayout::supports_smooth_scrolling() const {
 	return true;
 }
 
+int GridLayout::get_column_position(int col) const {
+	return (int) ROUND(grid->get_width_sum(col) * size) + col * useless_gap;
+}
+
+int GridLayout::get_row_position(int row) const {
+	return (int) ROUND(grid->get_height_sum(row) * size) + row * useless_gap;
+}
+
+int GridLayout::get_column_width(int col) const {
+	if (col < 0 || col >= grid->get_column_count()) {
+		return -1;
+	}
+	// differences of rounded positions, so that the rounding errors do not add up
+	return get_column_position(col + 1) - get_column_position(col) - useless_gap;
+}
+
+int GridLayout::get_row_height(int row) const {
+	if (row < 0 || row >= grid->get_row_count()) {
+		return -1;
+	}
+	return get_row_position(row + 1) - get_row_position(row) - useless_gap;
+}
+
@@ -17,6 +17,7 @@ public:
 	void activate(const Layout *old_layout);
 	void rebuild(bool clamp = true);
 	void resize(int w, int h);
+	void update_page_sizes(int first, int last);
 	void set_zoom(int new_zoom, bool relative = true);
 	void set_columns(int new_columns, bool relative = true);
 	void set_offset(int new_offset, bool relative = true);
@@ -53,6 +54,13 @@ private:
 	QRect get_target_rect(int target_page, QRectF target_rect) const;
 	QPoint get_target_page_distance(int target_page) const;
 
+	// scaled distance from the first column/row, including the gaps
+	int get_column_position(int col) const;
+	int get_row_position(int row) const;
+	// scaled size of a column/row, -1 if it does not exist
+	int get_column_width(int col) const;
+	int get_row_height(int row) const;
+
 	Grid *grid;
 
 	int off_x, off_y;
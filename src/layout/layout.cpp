@@ -1,5 +1,8 @@
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
 #include <QImage>
+#include <QTransform>
 #include <QDesktopServices>
 #include <QUrl>
 #include <QApplication>
@@ -11,10 +14,25 @@
 #include "../config.h"
 #include "../beamerwindow.h"
 #include "../util.h"
+#include "../kpage.h"
 
 using namespace std;
 
 
+// a scroll speed older than this is not used for predicting anymore
+static const qint64 motion_timeout = 1000; // ms
+// the prefetch window grows to the pages reached within this time
+static const float lookahead_time = 1.0f; // s
+
+
+//==[ ScaledPixmap ]===========================================================
+ScaledPixmap::ScaledPixmap() :
+		source(0),
+		rotation(0),
+		used(false) {
+}
+
+
 //==[ Layout ]=================================================================
 Layout::Layout(Viewer *v, int render_index, int _page) :
 		viewer(v), res(v->get_res()),
@@ -39,6 +57,9 @@ Layout::Layout(Viewer *v, int render_index, int _page) :
 	zoom_factor = config->get_value("Settings/zoom_factor").toFloat();
 	prefetch_count = config->get_value("Settings/prefetch_count").toInt();
 	jump_padding = config->get_value("Settings/jump_padding").toFloat();
+
+	prefetch_before = prefetch_after = prefetch_count;
+	keep_before = keep_after = prefetch_count * 3;
 }
 
 Layout::~Layout() {
@@ -60,6 +81,9 @@ void Layout::activate(const Layout *old_layout) {
 	hit_it = old_layout->hit_it;
 
 	selection = old_layout->selection;
+
+	// the motion in another layout says little about this one
+	motion_clock.invalidate();
 }
 
 void Layout::rebuild(bool clamp) {
@@ -75,10 +99,17 @@ void Layout::rebuild(bool clamp) {
 }
 
 void Layout::resize(int w, int h) {
+	if (w != width || h != height) {
+		res->begin_resize(render_index);
+	}
 	width = w;
 	height = h;
 }
 
+void Layout::update_page_sizes(int /*first*/, int /*last*/) {
+	// implement in child classes where necessary
+}
+
 void Layout::set_zoom(int /*new_zoom*/, bool /*relative*/) {
 	// implement in child classes where necessary
 }
@@ -234,7 +265,7 @@ void Layout::select(int px, int py, enum Selection::Mode mode) {
 	loc.second.rx() *= res->get_page_width(loc.first, false);
 	loc.second.ry() *= res->get_page_height(loc.first, false);
 
-	const QList<SelectionLine *> *text = res->get_text(loc.first);
+	const TextLayout *text = res->get_text(loc.first, true);
 	selection.set_cursor(text, loc, mode);
 	viewer->layout_updated(page, false); // TODO visible? change?
 }
@@ -245,7 +276,7 @@ void Layout::copy_selection_text(QClipboard::Mode mode) const {
 		Cursor from = selection.get_cursor(true);
 		Cursor to = selection.get_cursor(false);
 		for (int i = from.page; i <= to.page; i++) {
-			text += selection.get_selection_text(i, res->get_text(i));
+			text += selection.get_selection_text(i, res->get_text(i, true));
 		}
 	}
 	QClipboard *clipboard = QApplication::clipboard();
@@ -292,8 +323,8 @@ void Layout::render_selection(QPainter *painter, int cur_page, QPoint offset, fl
 	color.setAlpha(96);
 	painter->setBrush(color);
 
-	const QList<SelectionLine *> *text = res->get_text(cur_page);
-	if (text != NULL && text->size() != 0 && selection.is_active()) {
+	const TextLayout *text = res->get_text(cur_page);
+	if (text != NULL && text->line_count() != 0 && selection.is_active()) {
 		Cursor from = selection.get_cursor(true);
 		Cursor to = selection.get_cursor(false);
 		if (from.page <= cur_page && to.page >= cur_page) {
@@ -301,10 +332,10 @@ void Layout::render_selection(QPainter *painter, int cur_page, QPoint offset, fl
 				from.line = 0;
 			}
 			if (to.page > cur_page) {
-				to.line = text->size() - 1;
+				to.line = text->line_count() - 1;
 			}
 			for (int i = from.line; i <= to.line; i++) {
-				QRectF rect = text->at(i)->get_bbox();
+				QRectF rect = text->get_line(i).bbox;
 				if (from.page == cur_page && from.line == i) {
 					rect.setLeft(from.x);
 				}
@@ -331,6 +362,124 @@ void Layout::render_blank_page_background(QPainter *painter, int x, int y, int w
 	}
 }
 
+void Layout::render_page(QPainter *painter, int cur_page, int index, const KPage *k_page, const QRect &rect) {
+	// possibly the image of another view
+	int slot = k_page->get_slot(index, rect.width(), res->get_rotation());
+	const QImage *img = k_page->get_image(slot);
+	if (img == NULL) {
+		render_blank_page_background(painter, rect.x(), rect.y(), rect.width(), rect.height());
+		return;
+	}
+	int rot = (res->get_rotation() - k_page->get_rotation(slot) + 4) % 4;
+	if (rect.width() == k_page->get_width(slot) && rot == 0) { // draw as-is
+		painter->drawImage(rect.topLeft(), *img);
+		return;
+	}
+	if (rect.isEmpty()) {
+		return;
+	}
+	// a page-sized copy of a tiled or zoomed in page would take more memory
+	// than the page renders, only scale the part that is on screen
+	if (res->use_tiles(rect.width(), rect.height()) ||
+			(qint64) rect.width() * rect.height() > (qint64) width * height) {
+		render_page_clipped(painter, img, rot, rect);
+		return;
+	}
+
+	// scale and rotate only when something changed, not on every frame
+	ScaledPixmap &cached = pixmaps[make_pair(cur_page, index)];
+	cached.used = true;
+	if (cached.source != img->cacheKey() || cached.rotation != rot || cached.pixmap.size() != rect.size()) {
+		QSize size = rect.size();
+		if (rot == 1 || rot == 3) {
+			size.transpose();
+		}
+		// rotating the scaled image is cheaper; full renders are shrunk smoothly,
+		// previews and thumbnails are only placeholders
+		Qt::TransformationMode mode = img->width() > size.width() ? Qt::SmoothTransformation : Qt::FastTransformation;
+		QImage scaled = img->scaled(size, Qt::IgnoreAspectRatio, mode);
+		if (rot != 0) {
+			QTransform trans;
+			trans.rotate(rot * 90);
+			scaled = scaled.transformed(trans);
+		}
+		cached.source = img->cacheKey();
+		cached.rotation = rot;
+		cached.pixmap = QPixmap::fromImage(scaled);
+	}
+	painter->drawPixmap(rect.topLeft(), cached.pixmap);
+}
+
+void Layout::render_page_clipped(QPainter *painter, const QImage *img, int rot, const QRect &rect) {
+	QRect visible = rect & QRect(0, 0, width, height);
+	if (painter->hasClipping()) {
+		visible &= painter->clipBoundingRect().toAlignedRect();
+	}
+	if (visible.isEmpty()) {
+		return;
+	}
+	QSize size = rect.size();
+	if (rot == 1 || rot == 3) {
+		size.transpose();
+	}
+	// page coordinates, before rotating
+	QTransform trans;
+	trans.translate(rect.x() + rect.width() / 2.0, rect.y() + rect.height() / 2.0);
+	trans.rotate(rot * 90);
+	trans.translate(-size.width() / 2.0, -size.height() / 2.0);
+	QRectF target = trans.inverted().mapRect(QRectF(visible)) & QRectF(QPointF(0, 0), size);
+	if (target.isEmpty()) {
+		return;
+	}
+	float scale_x = (float) img->width() / size.width();
+	float scale_y = (float) img->height() / size.height();
+	QRectF source(target.x() * scale_x, target.y() * scale_y,
+			target.width() * scale_x, target.height() * scale_y);
+
+	painter->save();
+	painter->setTransform(trans, true);
+	painter->setRenderHint(QPainter::SmoothPixmapTransform, img->width() > size.width());
+	painter->drawImage(target, *img, source);
+	painter->restore();
+}
+
+void Layout::prune_pixmaps() {
+	for (map<pair<int, int>,ScaledPixmap>::iterator it = pixmaps.begin(); it != pixmaps.end(); ) {
+		if (!it->second.used) {
+			pixmaps.erase(it++);
+		} else {
+			it->second.used = false;
+			++it;
+		}
+	}
+}
+
+void Layout::render_tiles(QPainter *painter, int cur_page, const QRect &rect) {
+	if (!res->use_tiles(rect.width(), rect.height())) {
+		return;
+	}
+	int tile_size = res->get_tile_size();
+
+	// visible part of the page plus one tile in each direction
+	QRect visible = QRect(-rect.x(), -rect.y(), width, height);
+	visible.adjust(-tile_size, -tile_size, tile_size, tile_size);
+
+	const KPage *k_page = res->get_tiles(cur_page, rect.width(), visible);
+	if (k_page == NULL) {
+		return;
+	}
+	int rotation = res->get_rotation();
+	for (int row = visible.top() / tile_size; row <= visible.bottom() / tile_size; row++) {
+		for (int col = visible.left() / tile_size; col <= visible.right() / tile_size; col++) {
+			const QImage *img = k_page->get_tile(TileKey(rect.width(), rotation, col, row));
+			if (img != NULL) {
+				painter->drawImage(rect.x() + col * tile_size, rect.y() + row * tile_size, *img);
+			}
+		}
+	}
+	res->unlock_page(cur_page);
+}
+
 void Layout::view_hit() {
 	bool page_changed = scroll_page_noupdate(hit_page, false);
 	viewer->layout_updated(hit_page, page_changed);
@@ -338,7 +487,7 @@ void Layout::view_hit() {
 
 void Layout::activate_link(int page, float x, float y) {
 	// find matching box
-	const QList<Poppler::Link *> *links = res->get_links(page);
+	const QList<Poppler::Link *> *links = res->get_links(page, true);
 	if (links == NULL) {
 		return;
 	}
@@ -372,3 +521,65 @@ void Layout::activate_link(int page, float x, float y) {
 	}
 }
 
+void Layout::update_prefetch_window(int first_page) {
+	if (!motion_clock.isValid()) {
+		motion_page = first_page;
+		motion_direction = 0;
+		motion_speed = 0;
+		motion_clock.start();
+	}
+
+	int delta = first_page - motion_page;
+	qint64 elapsed = motion_clock.elapsed();
+	if (delta != 0) {
+		if (abs(delta) > prefetch_count * 3) {
+			// a jump, says nothing about where to go next
+			motion_direction = 0;
+			motion_speed = 0;
+		} else {
+			int direction = delta > 0 ? 1 : -1;
+			float speed = abs(delta) * 1000.0f / max(elapsed, (qint64) 1);
+			if (direction == motion_direction && elapsed < motion_timeout) {
+				motion_speed = (motion_speed + speed) / 2;
+			} else {
+				motion_speed = speed;
+			}
+			motion_direction = direction;
+		}
+		motion_page = first_page;
+		motion_clock.restart();
+	} else if (elapsed >= motion_timeout) {
+		// stopped, keep the direction for reading page by page
+		motion_speed = 0;
+	}
+
+	if (motion_direction == 0) {
+		prefetch_before = prefetch_after = prefetch_count;
+		keep_before = keep_after = prefetch_count * 3;
+		return;
+	}
+	// the pages reached within lookahead_time come on top, as far as the cache reaches
+	int ahead = prefetch_count + min((int) (motion_speed * lookahead_time), prefetch_count * 2);
+	// only a few pages back in case of turning around
+	int behind = (prefetch_count + 1) / 2;
+	if (motion_direction > 0) {
+		prefetch_after = ahead;
+		prefetch_before = behind;
+		keep_after = prefetch_count * 3;
+		keep_before = prefetch_count * 2;
+	} else {
+		prefetch_before = ahead;
+		prefetch_after = behind;
+		keep_before = prefetch_count * 3;
+		keep_after = prefetch_count * 2;
+	}
+}
+
+Render::Priority Layout::get_prefetch_priority(int distance) const {
+	// pages beyond the usual window wait until everything else is done
+	if (distance > prefetch_count) {
+		return Render::Speculative;
+	}
+	return Render::Prefetch;
+}
+
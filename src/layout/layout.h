@@ -2,8 +2,10 @@
 #define LAYOUT_H
 
 #include <QPainter>
+#include <QPixmap>
 #include <QList>
 #include <QClipboard>
+#include <QElapsedTimer>
 #if QT_VERSION >= 0x050000
 #	include <poppler-qt5.h>
 #else
@@ -11,16 +13,30 @@
 #endif
 #include <map>
 #include "../selection.h"
+#include "../scheduler.h"
 
 
 class Viewer;
 class ResourceManager;
 class Grid;
+class KPage;
 namespace Poppler {
 	class LinkDestination;
 }
 
 
+// a page image scaled and rotated to the size it is drawn at
+class ScaledPixmap {
+public:
+	ScaledPixmap();
+
+	qint64 source; // QImage::cacheKey()
+	int rotation;
+	QPixmap pixmap;
+	bool used; // since the last prune
+};
+
+
 class Layout {
 public:
 	Layout(Viewer *v, int render_index, int _page = 0);
@@ -29,6 +45,8 @@ public:
 	virtual void activate(const Layout *old_layout);
 	virtual void rebuild(bool clamp = true);
 	virtual void resize(int w, int h);
+	// the sizes of pages [first, last] are now known
+	virtual void update_page_sizes(int first, int last);
 
 	// normal movement
 	virtual void scroll_smooth(int dx, int dy);
@@ -76,6 +94,20 @@ protected:
 	void render_search_rects(QPainter *painter, int cur_page, QPoint offset, float size);
 	void render_selection(QPainter *painter, int cur_page, QPoint offset, float size);
 	void render_blank_page_background(QPainter *painter, int x, int y, int w, int h);
+	void render_tiles(QPainter *painter, int cur_page, const QRect &rect);
+	// draws the best available image of the page into rect; scaled or rotated
+	// versions of pages up to the view's size are kept until a frame is drawn
+	// without the page
+	void render_page(QPainter *painter, int cur_page, int index, const KPage *k_page, const QRect &rect);
+	// scales only the visible part of img, nothing is cached
+	void render_page_clipped(QPainter *painter, const QImage *img, int rot, const QRect &rect);
+	// call at the end of every frame
+	void prune_pixmaps();
+	// follows the first visible page from frame to frame and moves the
+	// prefetch window ahead of the motion; call once per frame
+	void update_prefetch_window(int first_page);
+	// for the page distance pages beyond the visible ones
+	Render::Priority get_prefetch_priority(int distance) const;
 	virtual void view_hit();
 
 	Viewer *viewer;
@@ -100,6 +132,18 @@ protected:
 	float jump_padding;
 
 	MouseSelection selection;
+
+	std::map<std::pair<int, int>, ScaledPixmap> pixmaps; // page, index
+
+	// pages around the visible ones to prefetch and to keep in the cache
+	int prefetch_before, prefetch_after;
+	int keep_before, keep_after;
+
+private:
+	int motion_page;
+	int motion_direction; // -1, 0 or 1
+	float motion_speed; // pages per second
+	QElapsedTimer motion_clock; // since motion_page changed
 };
 
 
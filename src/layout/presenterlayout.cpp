@@ -23,7 +23,16 @@ void PresenterLayout::rebuild(bool clamp) {
 	resize(width, height);
 }
 
+void PresenterLayout::update_page_sizes(int /*first*/, int /*last*/) {
+	// the split depends on the min/max aspect ratio
+	resize(width, height);
+}
+
 void PresenterLayout::resize(int w, int h) {
+	if (w != width || h != height) {
+		// the slot of the second slide
+		res->begin_resize(render_index + 1);
+	}
 	Layout::resize(w, h);
 
 	int small_width = width * main_ratio;
@@ -135,33 +144,8 @@ void PresenterLayout::render(QPainter *painter) {
 		int index = render_index + i;
 		const KPage *k_page = res->get_page(page + i, page_width[i], index);
 		if (k_page != NULL) {
-			const QImage *img = k_page->get_image(index);
-			if (img != NULL) {
-				int rot = (res->get_rotation() - k_page->get_rotation(index) + 4) % 4;
-				QRect rect;
-				painter->rotate(rot * 90);
-				// calculate page position
-				if (rot == 0) {
-					rect = QRect(center_x[i], center_y[i], page_width[i], page_height[i]);
-				} else if (rot == 1) {
-					rect = QRect(center_y[i], -center_x[i] - page_width[i],
-							page_height[i], page_width[i]);
-				} else if (rot == 2) {
-					rect = QRect(-center_x[i] - page_width[i], -center_y[i] - page_height[i],
-							page_width[i], page_height[i]);
-				} else if (rot == 3) {
-					rect = QRect(-center_y[i] - page_height[i], center_x[i],
-							page_height[i], page_width[i]);
-				}
-				if (page_width[i] != k_page->get_width(i) || rot != 0) { // draw scaled
-					painter->drawImage(rect, *img);
-				} else { // draw as-is
-					painter->drawImage(rect.topLeft(), *img);
-				}
-				painter->rotate(-rot * 90);
-			} else {
-				render_blank_page_background(painter, center_x[i], center_y[i], page_width[i], page_height[i]);
-			}
+			render_page(painter, page + i, index, k_page,
+					QRect(center_x[i], center_y[i], page_width[i], page_height[i]));
 			res->unlock_page(page + i);
 		}
 	}
@@ -179,19 +163,21 @@ void PresenterLayout::render(QPainter *painter) {
 		render_selection(painter, page + i, offset, factor);
 	}
 
+	prune_pixmaps();
+
 	// prefetch
 	for (int count = 1; count <= prefetch_count; count++) {
 		// after current page
-		if (res->get_page(page + count, calculate_fit_width(page + count), render_index) != NULL) {
+		if (res->get_page(page + count, calculate_fit_width(page + count), render_index, Render::Prefetch) != NULL) {
 			res->unlock_page(page + count);
 		}
 		// before current page
-		if (res->get_page(page - count, calculate_fit_width(page - count), render_index) != NULL) {
+		if (res->get_page(page - count, calculate_fit_width(page - count), render_index, Render::Prefetch) != NULL) {
 			res->unlock_page(page - count);
 		}
 	}
 	for (int i = 0; i < 2; i++) {
-		res->collect_garbage(page - prefetch_count * 3, page + 1 + prefetch_count * 3, render_index + i);
+		res->collect_garbage(page - prefetch_count * 3, page + 1 + prefetch_count * 3, render_index + i, page + i, page + i);
 	}
 }
 
@@ -10,6 +10,7 @@ public:
 
 	void rebuild(bool clamp = true);
 	void resize(int w, int h);
+	void update_page_sizes(int first, int last);
 
 	void render(QPainter *painter);
 
@@ -2,6 +2,7 @@
 #include <QImage>
 #include <QApplication>
 #include <set>
+#include <algorithm>
 #include "singlelayout.h"
 #include "layout.h"
 #include "../util.h"
@@ -44,34 +45,7 @@ void SingleLayout::render(QPainter *painter) {
 	const QRect p = calculate_placement(page);
 	const KPage *k_page = res->get_page(page, p.width(), render_index);
 	if (k_page != NULL) {
-		const QImage *img = k_page->get_image();
-		if (img != NULL) {
-			int rot = (res->get_rotation() - k_page->get_rotation() + 4) % 4;
-			QRect rect;
-			painter->rotate(rot * 90);
-			// calculate page position
-			if (rot == 0) {
-				rect = p;
-//				rect = QRect(p.x(), p.y(), p.width(), p.height());
-			} else if (rot == 1) {
-				rect = QRect(p.y(), -p.x() - p.width(),
-						p.height(), p.width());
-			} else if (rot == 2) {
-				rect = QRect(-p.x() - p.width(), -p.y() - p.height(),
-						p.width(), p.height());
-			} else if (rot == 3) {
-				rect = QRect(-p.y() - p.height(), p.x(),
-						p.height(), p.width());
-			}
-			if (p.width() != k_page->get_width() || rot != 0) { // draw scaled
-				painter->drawImage(rect, *img);
-			} else { // draw as-is
-				painter->drawImage(rect.topLeft(), *img);
-			}
-			painter->rotate(-rot * 90);
-		} else {
-			render_blank_page_background(painter, p.x(), p.y(), p.width(), p.height());
-		}
+		render_page(painter, page, render_index, k_page, p);
 		res->unlock_page(page);
 	}
 
@@ -101,18 +75,23 @@ void SingleLayout::render(QPainter *painter) {
 		}
 	} */
 
+	prune_pixmaps();
+
 	// prefetch
-	for (int count = 1; count <= prefetch_count; count++) {
+	update_prefetch_window(page);
+	for (int count = 1; count <= max(prefetch_after, prefetch_before); count++) {
 		// after current page
-		if (res->get_page(page + count, calculate_fit_width(page + count), render_index) != NULL) {
+		if (count <= prefetch_after &&
+				res->get_page(page + count, calculate_fit_width(page + count), render_index, get_prefetch_priority(count)) != NULL) {
 			res->unlock_page(page + count);
 		}
 		// before current page
-		if (res->get_page(page - count, calculate_fit_width(page - count), render_index) != NULL) {
+		if (count <= prefetch_before &&
+				res->get_page(page - count, calculate_fit_width(page - count), render_index, get_prefetch_priority(count)) != NULL) {
 			res->unlock_page(page - count);
 		}
 	}
-	res->collect_garbage(page - prefetch_count * 3, page + prefetch_count * 3, render_index);
+	res->collect_garbage(page - keep_before, page + keep_after, render_index, page, page);
 }
 
 void SingleLayout::advance_invisible_hit(bool forward) {
@@ -7,6 +7,7 @@
 #include "resourcemanager.h"
 #include "viewer.h"
 #include "config.h"
+#include "profiler.h"
 #include "dbus/dbus.h"
 
 using namespace std;
@@ -142,6 +143,8 @@ int main(int argc, char *argv[]) {
 	// initialize dbus interfaces
 	dbus_init(&katarakt);
 
-	return app.exec();
+	int ret = app.exec();
+	Profiler::get_instance()->write_trace();
+	return ret;
 }
 
@@ -0,0 +1,162 @@
+#include "profiler.h"
+#include "config.h"
+#include <QFile>
+#include <QThread>
+#include <iostream>
+
+using namespace std;
+
+
+static const char *stage_names[Profile::stage_count] = {
+	"paint",
+	"layout",
+	"render",
+	"preview",
+	"tile",
+	"invert",
+	"rotate",
+	"disk load",
+	"disk store",
+	"thumbnail",
+	"text",
+	"search"
+};
+
+// keeps the trace at a few MiB
+static const unsigned int max_events = 200000;
+
+
+Profiler::StageStats::StageStats() :
+		count(0),
+		total(0),
+		max(0) {
+}
+
+Profiler::Profiler() :
+		hud_visible(false),
+		events_dropped(false) {
+	trace_file = CFG::get_instance()->get_value("Settings/trace_file").toString();
+	enabled = !trace_file.isEmpty();
+	for (int i = 0; i < Profile::counter_count; i++) {
+		counters[i] = 0;
+	}
+	clock.start();
+}
+
+Profiler *Profiler::get_instance() {
+	static Profiler instance;
+	return &instance;
+}
+
+bool Profiler::is_enabled() const {
+	return enabled;
+}
+
+void Profiler::set_hud_visible(bool visible) {
+	mutex.lock();
+	hud_visible = visible;
+	enabled = hud_visible || !trace_file.isEmpty();
+	mutex.unlock();
+}
+
+qint64 Profiler::begin() const {
+	if (!enabled) {
+		return -1;
+	}
+	return clock.nsecsElapsed() / 1000;
+}
+
+void Profiler::end(Profile::Stage stage, qint64 start) {
+	if (start < 0) {
+		return;
+	}
+	qint64 duration = clock.nsecsElapsed() / 1000 - start;
+
+	mutex.lock();
+	StageStats &s = stats[stage];
+	s.count++;
+	s.total += duration;
+	if (duration > s.max) {
+		s.max = duration;
+	}
+	if (!trace_file.isEmpty()) {
+		if (events.size() < max_events) {
+			Event e;
+			e.stage = stage;
+			e.thread = reinterpret_cast<quintptr>(QThread::currentThreadId());
+			e.start = start;
+			e.duration = duration;
+			events.push_back(e);
+		} else {
+			events_dropped = true;
+		}
+	}
+	mutex.unlock();
+}
+
+void Profiler::count(Profile::Counter counter, int n) {
+	if (!enabled) {
+		return;
+	}
+	mutex.lock();
+	counters[counter] += n;
+	mutex.unlock();
+}
+
+QString Profiler::get_summary() {
+	mutex.lock();
+	QString text;
+	for (int i = 0; i < Profile::stage_count; i++) {
+		StageStats &s = stats[i];
+		if (s.count == 0) {
+			continue;
+		}
+		text += QString::fromUtf8("%1: %2x %3 ms, max %4 ms\n")
+			.arg(QString::fromUtf8(stage_names[i]))
+			.arg(s.count)
+			.arg(s.total / 1000.0 / s.count, 0, 'f', 1)
+			.arg(s.max / 1000.0, 0, 'f', 1);
+		s = StageStats();
+	}
+	int lookups = counters[Profile::CacheHit] + counters[Profile::CacheMiss];
+	if (lookups > 0) {
+		text += QString::fromUtf8("cache hits: %1%\n")
+			.arg(100 * counters[Profile::CacheHit] / lookups);
+	}
+	for (int i = 0; i < Profile::counter_count; i++) {
+		counters[i] = 0;
+	}
+	mutex.unlock();
+	return text;
+}
+
+bool Profiler::write_trace() {
+	if (trace_file.isEmpty()) {
+		return true;
+	}
+	QFile f(trace_file);
+	if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		cerr << "failed to write trace file " << trace_file.toUtf8().constData() << endl;
+		return false;
+	}
+
+	mutex.lock();
+	if (events_dropped) {
+		cerr << "trace is incomplete, only the first " << max_events << " events were kept" << endl;
+	}
+	f.write("{\"traceEvents\":[\n");
+	for (unsigned int i = 0; i < events.size(); i++) {
+		const Event &e = events[i];
+		QString line = QString::fromUtf8("{\"name\":\"%1\",\"ph\":\"X\",\"pid\":1,\"tid\":%2,\"ts\":%3,\"dur\":%4}%5\n")
+			.arg(QString::fromUtf8(stage_names[e.stage]))
+			.arg(e.thread)
+			.arg(e.start)
+			.arg(e.duration)
+			.arg(QString::fromUtf8(i + 1 < events.size() ? "," : ""));
+		f.write(line.toUtf8());
+	}
+	f.write("],\"displayTimeUnit\":\"ms\"}\n");
+	mutex.unlock();
+	return true;
+}
+
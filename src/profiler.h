@@ -0,0 +1,93 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QString>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <vector>
+
+
+namespace Profile {
+	enum Stage {
+		Paint,
+		Layout,
+		Render,
+		Preview,
+		Tile,
+		Invert,
+		Rotate,
+		DiskLoad,
+		DiskStore,
+		Thumbnail,
+		Text,
+		Search
+	};
+
+	const int stage_count = 12;
+
+	enum Counter {
+		CacheHit,
+		CacheMiss
+	};
+
+	const int counter_count = 2;
+}
+
+
+// collects how long the stages of drawing a page take; timings are only
+// taken while the hud is shown or a trace file is configured
+class Profiler {
+private:
+	Profiler();
+	Profiler(const Profiler &other);
+	Profiler &operator=(const Profiler &other);
+
+public:
+	static Profiler *get_instance();
+
+	bool is_enabled() const;
+	void set_hud_visible(bool visible);
+
+	// returns a start time to pass to end(), -1 when disabled
+	qint64 begin() const;
+	void end(Profile::Stage stage, qint64 start);
+	void count(Profile::Counter counter, int n = 1);
+
+	// averages since the last call, one stage per line
+	QString get_summary();
+
+	// chrome://tracing format, to the file configured in trace_file
+	bool write_trace();
+
+private:
+	class Event {
+	public:
+		Profile::Stage stage;
+		quintptr thread;
+		qint64 start; // us
+		qint64 duration;
+	};
+
+	class StageStats {
+	public:
+		StageStats();
+
+		int count;
+		qint64 total; // us
+		qint64 max;
+	};
+
+	volatile bool enabled;
+	bool hud_visible;
+	QString trace_file;
+	QElapsedTimer clock;
+
+	QMutex mutex;
+	StageStats stats[Profile::stage_count];
+	int counters[Profile::counter_count];
+	std::vector<Event> events;
+	bool events_dropped;
+};
+
+#endif
+
@@ -0,0 +1,95 @@
+#include "reloadworker.h"
+#include "resourcemanager.h"
+#include "documentpool.h"
+#include <QCryptographicHash>
+#include <iostream>
+#if QT_VERSION >= 0x050000
+#	include <poppler-qt5.h>
+#else
+#	include <poppler-qt4.h>
+#endif
+
+using namespace std;
+
+
+// how long to step back while visible pages are waiting to be rendered
+static const unsigned long idle_poll = 100; // ms
+
+
+// poppler does not expose the content streams, so hash everything that
+// ends up on screen: text, links and a coarse rendering
+static QByteArray page_fingerprint(Poppler::Document *doc, int page) {
+	Poppler::Page *p = doc->page(page);
+	if (p == NULL) {
+		return QByteArray();
+	}
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+
+	QSizeF size = p->pageSizeF();
+	hash.addData(QString::fromUtf8("%1 %2").arg(size.width()).arg(size.height()).toUtf8());
+	hash.addData(p->text(QRectF()).toUtf8());
+
+	Q_FOREACH(Poppler::Link *l, p->links()) {
+		QRectF area = l->linkArea();
+		QString desc = QString::fromUtf8("%1 %2 %3 %4 %5").arg(l->linkType())
+			.arg(area.x()).arg(area.y()).arg(area.width()).arg(area.height());
+		if (l->linkType() == Poppler::Link::Goto) {
+			Poppler::LinkGoto *link = static_cast<Poppler::LinkGoto *>(l);
+			desc += QString::fromUtf8(" %1 %2").arg(link->fileName()).arg(link->destination().pageNumber());
+		}
+		hash.addData(desc.toUtf8());
+		delete l;
+	}
+
+	QImage img = p->renderToImage(24, 24);
+	for (int y = 0; y < img.height(); y++) {
+		hash.addData(reinterpret_cast<const char *>(img.scanLine(y)), img.bytesPerLine());
+	}
+	delete p;
+	return hash.result();
+}
+
+
+//==[ ReloadWorker ]===========================================================
+ReloadWorker::ReloadWorker(ResourceManager *res, Poppler::Document *old_doc, const vector<int> &pages) :
+		die(false),
+		res(res),
+		old_doc(old_doc),
+		pages(pages) {
+}
+
+ReloadWorker::~ReloadWorker() {
+	delete old_doc;
+}
+
+void ReloadWorker::run() {
+	QSharedPointer<DocumentPool> documents = res->get_documents();
+	if (documents.isNull()) {
+		return;
+	}
+	vector<int>::const_iterator it = pages.begin();
+	while (!die && it != pages.end()) {
+		// the visible pages come first
+		if (res->scheduler.is_waiting(Render::Visible)) {
+			msleep(idle_poll);
+			continue;
+		}
+		Poppler::Document *doc = documents->acquire();
+		if (doc == NULL) {
+			cerr << "failed to open document for reload thread" << endl;
+			return;
+		}
+		bool same = same_page(old_doc, doc, *it);
+		documents->release(doc);
+		if (same) {
+			emit unchanged(*it);
+		}
+		++it;
+	}
+}
+
+bool ReloadWorker::same_page(Poppler::Document *old_doc, Poppler::Document *new_doc, int page) {
+	QByteArray fingerprint = page_fingerprint(new_doc, page);
+	return !fingerprint.isEmpty() && fingerprint == page_fingerprint(old_doc, page);
+}
+
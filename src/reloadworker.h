@@ -0,0 +1,41 @@
+#ifndef RELOADWORKER_H
+#define RELOADWORKER_H
+
+#include <QThread>
+#include <vector>
+
+
+class ResourceManager;
+namespace Poppler {
+	class Document;
+}
+
+
+// compares the pages of a reloaded document with its previous version in the
+// background, the resource manager moves the data of unchanged pages over
+class ReloadWorker : public QThread {
+	Q_OBJECT
+
+public:
+	// takes ownership of old_doc; pages are compared in this order
+	ReloadWorker(ResourceManager *res, Poppler::Document *old_doc, const std::vector<int> &pages);
+	~ReloadWorker();
+	void run();
+
+	// compares what ends up on screen; the documents must not be used by
+	// other threads meanwhile
+	static bool same_page(Poppler::Document *old_doc, Poppler::Document *new_doc, int page);
+
+	volatile bool die;
+
+signals:
+	void unchanged(int page);
+
+private:
+	ResourceManager *res;
+	Poppler::Document *old_doc;
+	std::vector<int> pages;
+};
+
+#endif
+
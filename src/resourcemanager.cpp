@@ -1,9 +1,14 @@
 #include <iostream>
 #include <limits>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
 #include <cerrno>
 #include <unistd.h>
 #include <QSocketNotifier>
 #include <QFileInfo>
+#include <QElapsedTimer>
+#include <QTransform>
 #ifdef __linux__
 #include <sys/inotify.h>
 #endif
@@ -12,47 +17,37 @@
 #include "util.h"
 #include "kpage.h"
 #include "worker.h"
+#include "textworker.h"
+#include "thumbnails.h"
+#include "reloadworker.h"
+#include "documentpool.h"
 #include "viewer.h"
 #include "beamerwindow.h"
 #include "selection.h"
+#include "config.h"
+#include "profiler.h"
 #include "layout/layout.h"
 
 using namespace std;
 
 
-Request::Request(int width, int index) {
-	for (int i = 0; i < 3; i++) {
-		this->width[i] = -1;
-	}
-	this->width[index] = width;
-}
+// quarter octaves, the steps of the resolution ladder
+static const float ladder_step = 1.189207f; // 2^(1/4)
+// how long a reload may compare prefetched pages before showing the document,
+// the pages on screen are always compared
+static const qint64 reload_sync_time = 100; // ms
 
-int Request::get_lowest_index() {
-	for (int i = 0; i < 3; i++) {
-		if (width[i] != -1) {
-			return i;
-		}
-	}
-	// will not happen
-	return 0;
-}
 
-bool Request::has_index(int index) {
-	return width[index] != -1;
+static int image_bytes(const QImage &img) {
+	return img.bytesPerLine() * img.height();
 }
 
-bool Request::remove_index_ok(int index) {
-	width[index] = -1;
-	for (int i = 0; i < 3; i++) {
-		if (width[i] != -1) {
-			return true;
-		}
+static int tile_map_bytes(const map<TileKey,QImage> &tiles) {
+	int bytes = 0;
+	for (map<TileKey,QImage>::const_iterator it = tiles.begin(); it != tiles.end(); ++it) {
+		bytes += image_bytes(it->second);
 	}
-	return false;
-}
-
-void Request::update(int width, int index) {
-	this->width[index] = width;
+	return bytes;
 }
 
 
@@ -60,32 +55,93 @@ ResourceManager::ResourceManager(const QString &file, Viewer *v) :
 		viewer(v),
 		file(file),
 		doc(NULL),
-		center_page(0),
+		text_worker(NULL),
+		reload_worker(NULL),
+		reload_k_page(NULL),
+		thumbnails(NULL),
 		rotation(0),
 #ifdef __linux__
 		i_notifier(NULL),
 #endif
 		inverted_colors(false),
 		cur_jump_pos(jumplist.end()) {
+	// load config options
+	CFG *config = CFG::get_instance();
+	preview_scale = config->get_value("Settings/preview_scale").toFloat();
+	settle_time = config->get_value("Settings/resize_settle_time").toInt();
+	tile_size = config->get_value("Settings/tile_size").toInt();
+	tile_threshold = config->get_value("Settings/tile_threshold").toFloat() * 1000000.0f;
+	cache_limit = config->get_value("Settings/cache_size").toLongLong() * 1024 * 1024;
+	smooth_downscaling = config->get_value("Settings/thumbnail_filter").toBool();
+	thumbnail_size = config->get_value("Settings/thumbnail_size").toInt();
+	thumbnail_threads = config->get_value("Settings/thumbnail_threads").toInt();
+	if (thumbnail_threads <= 0) {
+		thumbnail_threads = QThread::idealThreadCount();
+	}
+	if (thumbnail_threads <= 0) { // could not be detected
+		thumbnail_threads = 1;
+	}
+
+	size_timer.setInterval(0);
+	connect(&size_timer, SIGNAL(timeout()), this, SLOT(load_page_sizes()));
+	settle_timer.setSingleShot(true);
+	connect(&settle_timer, SIGNAL(timeout()), this, SIGNAL(resize_settled()));
+
 	initialize(file, QByteArray());
 }
 
 void ResourceManager::initialize(const QString &file, const QByteArray &password) {
 	page_count = 0;
 	k_page = NULL;
+	doc_file = file;
+	cache_bytes = 0;
+	scheduler.reset();
+	sizes_loaded = 0;
+	sizes_differ = false;
+	tile_bytes.fetchAndStoreOrdered(0);
+	for (int i = 0; i < render_index_count; i++) {
+		visible_min[i] = 0;
+		visible_max[i] = -1;
+		prefetch_min[i] = 0;
+		prefetch_max[i] = -1;
+	}
 
 	doc = NULL;
 	if (!file.isNull()) {
 		doc = Poppler::Document::load(file, QByteArray(), password);
 	}
 
-	worker = new Worker(this);
-	if (viewer->get_canvas() != NULL) {
-		// on first start the canvas has not yet been constructed
-		connect(worker, SIGNAL(page_rendered(int)), viewer->get_canvas(), SLOT(page_rendered(int)), Qt::UniqueConnection);
-		connect(worker, SIGNAL(page_rendered(int)), viewer->get_beamer(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+	// only spawn additional render threads for documents that can be rendered
+	int thread_count = 1;
+	if (doc != NULL && !doc->isLocked()) {
+		disk_cache.open(file);
+
+		thread_count = CFG::get_instance()->get_value("Settings/render_threads").toInt();
+		if (thread_count <= 0) {
+			thread_count = QThread::idealThreadCount();
+		}
+		if (thread_count <= 0) { // could not be detected
+			thread_count = 1;
+		}
+		// one more for the text, thumbnail and search threads while all render threads are busy
+		documents = QSharedPointer<DocumentPool>(new DocumentPool(file, password, thread_count + 1));
+
+		text_worker = new TextWorker(this);
+		if (viewer->get_canvas() != NULL) {
+			connect(text_worker, SIGNAL(text_ready(int)), viewer->get_canvas(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+		}
+		text_worker->start(QThread::LowPriority);
+	}
+	for (int i = 0; i < thread_count; i++) {
+		Worker *worker = new Worker(this, i);
+		if (viewer->get_canvas() != NULL) {
+			// on first start the canvas has not yet been constructed
+			connect(worker, SIGNAL(page_rendered(int)), viewer->get_canvas(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+			connect(worker, SIGNAL(page_rendered(int)), viewer->get_beamer(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+		}
+		workers.push_back(worker);
+		worker->start();
 	}
-	worker->start();
 
 	// setup inotify
 #ifdef __linux__
@@ -115,33 +171,74 @@ void ResourceManager::initialize(const QString &file, const QByteArray &password
 //		cerr << "missing password" << endl;
 		return;
 	}
-	doc->setRenderHint(Poppler::Document::Antialiasing, true);
-	doc->setRenderHint(Poppler::Document::TextAntialiasing, true);
-	doc->setRenderHint(Poppler::Document::TextHinting, true);
-#if POPPLER_VERSION >= POPPLER_VERSION_CHECK(0, 18, 0)
-	doc->setRenderHint(Poppler::Document::TextSlightHinting, true);
-#endif
-#if POPPLER_VERSION >= POPPLER_VERSION_CHECK(0, 22, 0)
-//	doc->setRenderHint(Poppler::Document::OverprintPreview, true); // TODO what is this?
-#endif
-#if POPPLER_VERSION >= POPPLER_VERSION_CHECK(0, 24, 0)
-	doc->setRenderHint(Poppler::Document::ThinLineSolid, true); // TODO what's the difference between ThinLineSolid and ThinLineShape?
-#endif
+	set_render_hints(doc);
 
 	page_count = doc->numPages();
 
 	min_aspect = numeric_limits<float>::max();
 	max_aspect = numeric_limits<float>::min();
+	if (page_count == 0) {
+		return;
+	}
+
+	// loading every page size up front takes too long for huge documents;
+	// assume the first page's size until load_page_sizes() gets to a page
+	QSizeF size(595, 842); // A4
+	Poppler::Page *p = doc->page(0);
+	if (p == NULL) {
+		cerr << "failed to load page 0" << endl;
+	} else {
+		size = p->pageSizeF();
+		delete p;
+	}
 
 	k_page = new KPage[get_page_count()];
 	for (int i = 0; i < get_page_count(); i++) {
+		k_page[i].width = size.width();
+		k_page[i].height = size.height();
+	}
+	min_aspect = max_aspect = size.width() / size.height();
+
+	sizes_loaded = 1;
+	size_timer.start();
+
+	// fill in the thumbnails of all pages in the background
+	if (thumbnail_size > 0) {
+		thumbnails = new ThumbnailAtlas(page_count, thumbnail_size);
+		for (int i = 0; i < thumbnail_threads; i++) {
+			ThumbnailWorker *worker = new ThumbnailWorker(this);
+			if (viewer->get_canvas() != NULL) {
+				connect(worker, SIGNAL(page_rendered(int)), viewer->get_canvas(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+				connect(worker, SIGNAL(page_rendered(int)), viewer->get_beamer(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+			}
+			thumbnail_workers.push_back(worker);
+			worker->start(QThread::LowPriority);
+		}
+	}
+}
+
+void ResourceManager::load_page_sizes() {
+	// work in small batches to keep the ui responsive
+	QElapsedTimer timer;
+	timer.start();
+	int first = page_count;
+	int last = -1;
+	while (sizes_loaded < page_count && !timer.hasExpired(10)) {
+		int i = sizes_loaded++;
 		Poppler::Page *p = doc->page(i);
 		if (p == NULL) {
 			cerr << "failed to load page " << i << endl;
 			continue;
 		}
-		k_page[i].width = p->pageSizeF().width();
-		k_page[i].height = p->pageSizeF().height();
+		QSizeF size = p->pageSizeF();
+		delete p;
+
+		if ((float) size.width() == k_page[i].width && (float) size.height() == k_page[i].height) {
+			continue;
+		}
+		// only the gui thread uses the sizes, workers ask poppler
+		k_page[i].width = size.width();
+		k_page[i].height = size.height();
 
 		float aspect = k_page[i].width / k_page[i].height;
 		if (aspect < min_aspect) {
@@ -151,11 +248,19 @@ void ResourceManager::initialize(const QString &file, const QByteArray &password
 			max_aspect = aspect;
 		}
 
-//		k_page[i].label = p->label();
-//		if (k_page[i].label != QString::number(i + 1)) {
-//			cout << i << endl;
-//		}
-		delete p;
+		first = min(first, i);
+		last = i;
+	}
+
+	if (sizes_loaded >= page_count) {
+		size_timer.stop();
+		if (sizes_differ || last != -1) {
+			// lets the grid shrink columns sized after the first page
+			emit page_sizes_changed(0, page_count - 1);
+		}
+	} else if (last != -1) {
+		sizes_differ = true;
+		emit page_sizes_changed(first, last);
 	}
 }
 
@@ -164,29 +269,240 @@ ResourceManager::~ResourceManager() {
 }
 
 void ResourceManager::shutdown() {
-	if (worker != NULL) {
-		join_threads();
-	}
+	size_timer.stop();
+	join_threads();
 	garbageMutex.lock();
-	for (int i = 0; i < 3; i++) {
-		garbage[i].clear();
-	}
+	lru.clear();
+	cache.clear();
+	tile_garbage.clear();
 	garbageMutex.unlock();
-	requests.clear();
-	requestSemaphore.acquire(requestSemaphore.available());
 #ifdef __linux__
 	::close(inotify_fd);
 	delete i_notifier;
 	i_notifier = NULL;
 #endif
+	for (vector<Worker *>::iterator it = workers.begin(); it != workers.end(); ++it) {
+		delete *it;
+	}
+	workers.clear();
+	delete text_worker;
+	text_worker = NULL;
+	// the pages of an unfinished reload are not adopted anymore
+	delete reload_worker;
+	reload_worker = NULL;
+	delete[] reload_k_page;
+	reload_k_page = NULL;
+	for (vector<ThumbnailWorker *>::iterator it = thumbnail_workers.begin(); it != thumbnail_workers.end(); ++it) {
+		delete *it;
+	}
+	thumbnail_workers.clear();
+	// users outside, like the search bar, keep their reference
+	documents.clear();
+	disk_cache.close();
 	delete doc;
+	// the thumbnails are views into the atlas
 	delete[] k_page;
-	delete worker;
+	delete thumbnails;
+	thumbnails = NULL;
 }
 
 void ResourceManager::load(const QString &file, const QByteArray &password) {
+	if (doc == NULL || doc->isLocked() || file != doc_file) {
+		shutdown();
+		initialize(file, password);
+		return;
+	}
+
+	// reloading the same file, keep the old pages around to reuse unchanged ones
+	join_threads();
+	Poppler::Document *old_doc = doc;
+	KPage *old_k_page = k_page;
+	int old_page_count = page_count;
+	doc = NULL;
+	k_page = NULL;
+	// initialize() forgets what the views show
+	int old_visible_min[render_index_count], old_visible_max[render_index_count];
+	int old_prefetch_min[render_index_count], old_prefetch_max[render_index_count];
+	for (int i = 0; i < render_index_count; i++) {
+		old_visible_min[i] = visible_min[i];
+		old_visible_max[i] = visible_max[i];
+		old_prefetch_min[i] = prefetch_min[i];
+		old_prefetch_max[i] = prefetch_max[i];
+	}
+	int center = scheduler.get_center();
+
 	shutdown();
 	initialize(file, password);
+	if (doc == NULL || doc->isLocked()) {
+		delete old_doc;
+		delete[] old_k_page;
+		return;
+	}
+
+	// only pages holding images are worth the comparison, thumbnails are
+	// rendered again by the thumbnail workers anyway
+	vector<int> visible;
+	vector<pair<int, int> > prefetched, rest; // distance to the center, page
+	int count = min(old_page_count, page_count);
+	for (int i = 0; i < count; i++) {
+		bool has_image = false;
+		for (int j = 0; j < render_index_count; j++) {
+			if (!old_k_page[i].img[j].isNull() || !old_k_page[i].img_other[j].isNull()) {
+				has_image = true;
+			}
+		}
+		if (!has_image) {
+			continue;
+		}
+		bool on_screen = false, in_prefetch = false;
+		for (int j = 0; j < render_index_count; j++) {
+			on_screen |= i >= old_visible_min[j] && i <= old_visible_max[j];
+			in_prefetch |= i >= old_prefetch_min[j] && i <= old_prefetch_max[j];
+		}
+		if (on_screen) {
+			visible.push_back(i);
+		} else if (in_prefetch) {
+			prefetched.push_back(make_pair(abs(i - center), i));
+		} else {
+			rest.push_back(make_pair(abs(i - center), i));
+		}
+	}
+	sort(prefetched.begin(), prefetched.end());
+	sort(rest.begin(), rest.end());
+	reload_k_page = old_k_page;
+
+	// nothing has been drawn or requested yet, the pages on screen and the
+	// next ones are compared right away so they don't flash or render again
+	QElapsedTimer timer;
+	timer.start();
+	for (vector<int>::iterator it = visible.begin(); it != visible.end(); ++it) {
+		if (ReloadWorker::same_page(old_doc, doc, *it)) {
+			adopt_page(*it);
+		}
+	}
+	vector<int> pages;
+	for (vector<pair<int, int> >::iterator it = prefetched.begin(); it != prefetched.end(); ++it) {
+		if (timer.hasExpired(reload_sync_time)) {
+			pages.push_back(it->second);
+		} else if (ReloadWorker::same_page(old_doc, doc, it->second)) {
+			adopt_page(it->second);
+		}
+	}
+	for (vector<pair<int, int> >::iterator it = rest.begin(); it != rest.end(); ++it) {
+		pages.push_back(it->second);
+	}
+	if (pages.empty()) {
+		delete old_doc;
+		delete[] reload_k_page;
+		reload_k_page = NULL;
+		return;
+	}
+
+	// the rest don't block the gui, they are adopted one by one
+	reload_worker = new ReloadWorker(this, old_doc, pages);
+	connect(reload_worker, SIGNAL(unchanged(int)), this, SLOT(adopt_unchanged(int)));
+	connect(reload_worker, SIGNAL(finished()), this, SLOT(finish_reload()));
+	reload_worker->start(QThread::LowPriority);
+}
+
+void ResourceManager::adopt_unchanged(int page) {
+	// a worker of an earlier reload that was stopped
+	if (reload_worker == NULL || sender() != reload_worker) {
+		return;
+	}
+	adopt_page(page);
+}
+
+void ResourceManager::finish_reload() {
+	if (reload_worker == NULL || sender() != reload_worker) {
+		return;
+	}
+	delete reload_worker;
+	reload_worker = NULL;
+	delete[] reload_k_page;
+	reload_k_page = NULL;
+}
+
+void ResourceManager::adopt_page(int page) {
+	KPage &old = reload_k_page[page];
+	KPage &kp = k_page[page];
+
+	// the render workers may have been faster, keep what they made
+	bool adopted[render_index_count];
+	kp.mutex.lock();
+	if (kp.inverted_colors != old.inverted_colors) {
+		kp.toggle_invert_colors();
+	}
+	for (int j = 0; j < render_index_count; j++) {
+		adopted[j] = kp.img[j].isNull() && kp.img_other[j].isNull() &&
+			(!old.img[j].isNull() || !old.img_other[j].isNull());
+		if (adopted[j]) {
+			kp.img[j].swap(old.img[j]);
+			kp.img_other[j].swap(old.img_other[j]);
+			kp.status[j] = old.status[j];
+			kp.rotation[j] = old.rotation[j];
+		}
+	}
+	kp.mutex.unlock();
+	// tiles are cheap to get back and would escape garbage collection
+	link_mutex.lock();
+	if (kp.links == NULL) {
+		swap(kp.links, old.links);
+	}
+	if (kp.text == NULL) {
+		swap(kp.text, old.text);
+	}
+	link_mutex.unlock();
+
+	for (int j = 0; j < render_index_count; j++) {
+		if (adopted[j]) {
+			cache_insert(page, j);
+		}
+	}
+	// the old thumbnail was a view into the old atlas
+	for (int j = 0; j < render_index_count; j++) {
+		kp.mutex.lock();
+		QImage img = kp.inverted_colors ? kp.img_other[j] : kp.img[j];
+		int rotation = kp.rotation[j];
+		kp.mutex.unlock();
+		if (!img.isNull()) {
+			set_thumbnail(page, img, rotation);
+			break;
+		}
+	}
+	emit page_rendered(page);
+}
+
+bool ResourceManager::set_thumbnail(int page, const QImage &img, int rotation) {
+	if (thumbnails == NULL || thumbnails->has(page)) {
+		return false;
+	}
+	Qt::TransformationMode mode = Qt::FastTransformation;
+	if (smooth_downscaling) {
+		mode = Qt::SmoothTransformation;
+	}
+	// scale
+	QImage scaled = img.scaled(QSize(thumbnail_size, thumbnail_size), Qt::IgnoreAspectRatio, mode);
+	// rotate
+	if (rotation != 0) {
+		QTransform trans;
+		trans.rotate(-rotation * 90);
+		scaled = scaled.transformed(trans);
+	}
+
+	QImage thumbnail, inverted;
+	if (!thumbnails->insert(page, scaled, &thumbnail, &inverted)) {
+		return false;
+	}
+	KPage &kp = k_page[page];
+	kp.mutex.lock();
+	kp.thumbnail = thumbnail;
+	kp.thumbnail_other = inverted;
+	if (kp.inverted_colors) {
+		kp.thumbnail.swap(kp.thumbnail_other);
+	}
+	kp.mutex.unlock();
+	return true;
 }
 
 bool ResourceManager::is_valid() const {
@@ -208,11 +524,40 @@ void ResourceManager::set_file(const QString &new_file) {
 	file = new_file;
 }
 
-const KPage *ResourceManager::get_page(int page, int width, int index) {
+// the widths of the resolution ladder are powers of ladder_step
+static int ladder_width(int width) {
+	if (width <= 1) {
+		return width;
+	}
+	int level = ROUND(log((float) width) / log(ladder_step));
+	return ROUND(pow(ladder_step, level));
+}
+
+static bool is_close_size(int a, int b) {
+	return max(a, b) <= min(a, b) * ladder_step;
+}
+
+const KPage *ResourceManager::get_page(int page, int width, int index, Render::Priority priority) {
 	if (page < 0 || page >= get_page_count()) {
 		return NULL;
 	}
 
+	// huge pages are drawn in tiles on top of a reduced resolution version
+	bool tiled = use_tiles(width, ROUND(width / get_page_aspect(page)));
+	if (tiled) {
+		width = sqrt(tile_threshold * get_page_aspect(page));
+	}
+
+	// the view may draw another view's image, that one is in use as well;
+	// must not hold the page's lock
+	k_page[page].mutex.lock();
+	int slot = k_page[page].get_slot(index, width, rotation);
+	k_page[page].mutex.unlock();
+	cache_touch(page, index);
+	if (slot != index) {
+		cache_touch(page, slot);
+	}
+
 	// page not available or wrong size/rotation/color
 	k_page[page].mutex.lock();
 	bool must_invert_colors = k_page[page].inverted_colors != inverted_colors;
@@ -220,16 +565,118 @@ const KPage *ResourceManager::get_page(int page, int width, int index) {
 		k_page[page].toggle_invert_colors();
 	}
 
-	if (k_page[page].img[index].isNull() ||
+	// while zooming, an image of a similar size or the nearest step of the ladder will do
+	bool resizing = !tiled && !k_page[page].img[index].isNull() && is_resizing(index);
+	if (k_page[page].get_slot(index, width, rotation) != index) {
+		// another view has the page at a size that can be scaled down
+		Profiler::get_instance()->count(Profile::CacheHit);
+	} else if (resizing && k_page[page].rotation[index] == rotation &&
+			is_close_size(k_page[page].status[index], width)) {
+		Profiler::get_instance()->count(Profile::CacheHit);
+	} else if (k_page[page].img[index].isNull() ||
 			k_page[page].status[index] != width ||
 			k_page[page].rotation[index] != rotation ||
 			must_invert_colors) {
-		enqueue(page, width, index);
+		Profiler::get_instance()->count(Profile::CacheMiss);
+		int render_width = resizing ? ladder_width(width) : width;
+		scheduler.enqueue(RenderJob(RenderJob::Page, page, index, render_width), priority);
+
+		// nothing to show but the thumbnail, quickly render a low resolution version first
+		const QImage *img = k_page[page].get_image(index);
+		if (priority == Render::Visible && preview_scale > 0.0f && (img == NULL || img == &k_page[page].thumbnail)) {
+			scheduler.enqueue(RenderJob(RenderJob::Preview, page, index, width), priority);
+		}
+	} else {
+		Profiler::get_instance()->count(Profile::CacheHit);
 	}
 
 	return &k_page[page];
 }
 
+const KPage *ResourceManager::get_tiles(int page, int width, const QRect &rect) {
+	if (page < 0 || page >= get_page_count()) {
+		return NULL;
+	}
+	KPage &kp = k_page[page];
+
+	// clamp to the page
+	int height = ROUND(width / get_page_aspect(page));
+	QRect r = rect.intersected(QRect(0, 0, width, height));
+	int col_min = r.left() / tile_size;
+	int col_max = r.right() / tile_size;
+	int row_min = r.top() / tile_size;
+	int row_max = r.bottom() / tile_size;
+
+	garbageMutex.lock();
+	tile_garbage.insert(page);
+	garbageMutex.unlock();
+
+	kp.mutex.lock();
+	if (kp.inverted_colors != inverted_colors) {
+		kp.toggle_invert_colors();
+	}
+
+	// the reduced resolution version has to do while zooming
+	if (is_resizing(0)) {
+		scheduler.set_tiles(page, set<TileKey>());
+		return &kp;
+	}
+
+	// drop tiles of other sizes and tiles far outside the view
+	map<TileKey,QImage> *tiles[2] = {&kp.tiles, &kp.tiles_other};
+	for (int i = 0; i < 2; i++) {
+		for (map<TileKey,QImage>::iterator it = tiles[i]->begin(); it != tiles[i]->end(); ) {
+			const TileKey &key = it->first;
+			if (key.width != width || key.rotation != rotation ||
+					key.col < col_min || key.col > col_max ||
+					key.row < row_min || key.row > row_max) {
+				tile_bytes.fetchAndAddOrdered(-image_bytes(it->second));
+				tiles[i]->erase(it++);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	// collect missing tiles
+	set<TileKey> missing;
+	if (!r.isEmpty()) {
+		for (int row = row_min; row <= row_max; row++) {
+			for (int col = col_min; col <= col_max; col++) {
+				TileKey key(width, rotation, col, row);
+				if (kp.tiles.find(key) == kp.tiles.end()) {
+					missing.insert(key);
+				}
+			}
+		}
+	}
+
+	// replace the outdated requests for this page
+	scheduler.set_tiles(page, missing);
+
+	return &kp;
+}
+
+void ResourceManager::begin_resize(int index) {
+	if (settle_time <= 0) {
+		return;
+	}
+	resized[index].start();
+	settle_timer.start(settle_time);
+}
+
+bool ResourceManager::is_resizing(int index) const {
+	return resized[index].isValid() && resized[index].elapsed() < settle_time;
+}
+
+bool ResourceManager::use_tiles(int width, int height) const {
+	return tile_threshold > 0.0f && (float) width * height > tile_threshold;
+}
+
+int ResourceManager::get_tile_size() const {
+	return tile_size;
+}
+
 int ResourceManager::get_rotation() const {
 	return rotation;
 }
@@ -255,23 +702,109 @@ bool ResourceManager::are_colors_inverted() const {
 	return inverted_colors;
 }
 
-void ResourceManager::collect_garbage(int keep_min, int keep_max, int index) {
-	requestMutex.lock();
-	if (index == 0) { // make a separate center_page for each index?
-		center_page = (keep_min + keep_max) / 2;
+void ResourceManager::collect_garbage(int keep_min, int keep_max, int index, int visible_min, int visible_max) {
+	scheduler.set_center(index, (keep_min + keep_max) / 2);
+	// free least recently used pages until the cache fits
+	garbageMutex.lock();
+	this->visible_min[index] = visible_min;
+	this->visible_max[index] = visible_max;
+	prefetch_min[index] = keep_min;
+	prefetch_max[index] = keep_max;
+	cache_evict();
+	// tiles are only used by the main view
+	if (index == 0) {
+		for (set<int>::iterator it = tile_garbage.begin(); it != tile_garbage.end(); ) {
+			int page = *it;
+			if (page >= keep_min && page <= keep_max) {
+				++it;
+				continue;
+			}
+			tile_garbage.erase(it++);
+			k_page[page].mutex.lock();
+			tile_bytes.fetchAndAddOrdered(-tile_map_bytes(k_page[page].tiles) - tile_map_bytes(k_page[page].tiles_other));
+			k_page[page].tiles.clear();
+			k_page[page].tiles_other.clear();
+			k_page[page].mutex.unlock();
+		}
+	}
+	garbageMutex.unlock();
+
+	// requests that went out of view are stale
+	scheduler.end_frame(index);
+	if (keep_max >= keep_min) {
+		scheduler.cancel_outside(index, keep_min, keep_max);
 	}
-	requestMutex.unlock();
-	// free distant pages
+}
+
+SchedulerStats ResourceManager::get_render_stats() {
+	return scheduler.get_stats();
+}
+
+qint64 ResourceManager::get_cache_size() {
+	garbageMutex.lock();
+	qint64 bytes = cache_bytes + tile_bytes.fetchAndAddOrdered(0);
+	if (thumbnails != NULL) {
+		bytes += thumbnails->get_bytes();
+	}
+	garbageMutex.unlock();
+	return bytes;
+}
+
+void ResourceManager::add_tile_bytes(int bytes) {
+	tile_bytes.fetchAndAddOrdered(bytes);
+}
+
+void ResourceManager::cache_insert(int page, int index) {
 	garbageMutex.lock();
-	for (set<int>::iterator it = garbage[index].begin(); it != garbage[index].end(); /* empty */) {
-		int page = *it;
-		if (page >= keep_min && page <= keep_max) {
-			++it; // move on
+	k_page[page].mutex.lock();
+	int bytes = image_bytes(k_page[page].img[index]) + image_bytes(k_page[page].img_other[index]);
+	k_page[page].mutex.unlock();
+
+	CacheKey key(page, index);
+	map<CacheKey,CacheEntry>::iterator it = cache.find(key);
+	if (it == cache.end()) {
+		lru.push_back(key);
+		CacheEntry entry;
+		entry.lru_pos = --lru.end();
+		entry.bytes = bytes;
+		cache.insert(make_pair(key, entry));
+	} else {
+		lru.splice(lru.end(), lru, it->second.lru_pos);
+		cache_bytes -= it->second.bytes;
+		it->second.bytes = bytes;
+	}
+	cache_bytes += bytes;
+
+	cache_evict();
+	garbageMutex.unlock();
+}
+
+void ResourceManager::cache_touch(int page, int index) {
+	garbageMutex.lock();
+	map<CacheKey,CacheEntry>::iterator it = cache.find(CacheKey(page, index));
+	if (it != cache.end()) {
+		lru.splice(lru.end(), lru, it->second.lru_pos);
+	}
+	garbageMutex.unlock();
+}
+
+// garbageMutex must be locked
+void ResourceManager::cache_evict() {
+	// tiles and thumbnails can't be evicted here, they leave less room for the pages
+	qint64 other_bytes = tile_bytes.fetchAndAddOrdered(0);
+	if (thumbnails != NULL) {
+		other_bytes += thumbnails->get_bytes();
+	}
+	list<CacheKey>::iterator it = lru.begin();
+	while (cache_bytes + other_bytes > cache_limit && it != lru.end()) {
+		int page = it->first;
+		int index = it->second;
+		if (page >= visible_min[index] && page <= visible_max[index]) {
+			++it; // on screen
 			continue;
 		}
-		garbage[index].erase(it++); // erase and move on (iterator becomes invalid)
 #ifdef DEBUG
-		cerr << "    removing page " << page << endl;
+		cerr << "    removing page " << page << " for index " << index << endl;
 #endif
 		k_page[page].mutex.lock();
 		k_page[page].img[index] = QImage();
@@ -279,30 +812,40 @@ void ResourceManager::collect_garbage(int keep_min, int keep_max, int index) {
 		k_page[page].status[index] = 0;
 		k_page[page].rotation[index] = 0;
 		k_page[page].mutex.unlock();
-	}
-	garbageMutex.unlock();
 
-	// keep the request list small
-	if (keep_max < keep_min) {
-		return;
+		map<CacheKey,CacheEntry>::iterator entry = cache.find(*it);
+		cache_bytes -= entry->second.bytes;
+		cache.erase(entry);
+		lru.erase(it++);
 	}
-	requestMutex.lock();
-	for (map<int,Request>::iterator it = requests.begin(); it != requests.end(); ) {
-		if ((it->first < keep_min || it->first > keep_max) && it->second.has_index(index)) {
-			if (!it->second.remove_index_ok(index)) { // no index left in request -> delete
-				requestSemaphore.acquire(1);
-				requests.erase(it++);
-			}
-		} else {
-			++it;
-		}
-	}
-	requestMutex.unlock();
+}
+
+const DiskCache *ResourceManager::get_disk_cache() const {
+	return &disk_cache;
+}
+
+QSharedPointer<DocumentPool> ResourceManager::get_documents() const {
+	return documents;
 }
 
 void ResourceManager::connect_canvas() const {
-	connect(worker, SIGNAL(page_rendered(int)), viewer->get_canvas(), SLOT(page_rendered(int)), Qt::UniqueConnection);
-	connect(worker, SIGNAL(page_rendered(int)), viewer->get_beamer(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+	for (vector<Worker *>::const_iterator it = workers.begin(); it != workers.end(); ++it) {
+		connect(*it, SIGNAL(page_rendered(int)), viewer->get_canvas(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+		connect(*it, SIGNAL(page_rendered(int)), viewer->get_beamer(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+	}
+	if (text_worker != NULL) {
+		connect(text_worker, SIGNAL(text_ready(int)), viewer->get_canvas(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+	}
+	for (vector<ThumbnailWorker *>::const_iterator it = thumbnail_workers.begin(); it != thumbnail_workers.end(); ++it) {
+		connect(*it, SIGNAL(page_rendered(int)), viewer->get_canvas(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+		connect(*it, SIGNAL(page_rendered(int)), viewer->get_beamer(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+	}
+	connect(this, SIGNAL(page_sizes_changed(int, int)), viewer->get_canvas(), SLOT(page_sizes_changed(int, int)), Qt::UniqueConnection);
+	connect(this, SIGNAL(page_sizes_changed(int, int)), viewer->get_beamer(), SLOT(page_sizes_changed(int, int)), Qt::UniqueConnection);
+	connect(this, SIGNAL(resize_settled()), viewer->get_canvas(), SLOT(update()), Qt::UniqueConnection);
+	connect(this, SIGNAL(resize_settled()), viewer->get_beamer(), SLOT(update()), Qt::UniqueConnection);
+	connect(this, SIGNAL(page_rendered(int)), viewer->get_canvas(), SLOT(page_rendered(int)), Qt::UniqueConnection);
+	connect(this, SIGNAL(page_rendered(int)), viewer->get_beamer(), SLOT(page_rendered(int)), Qt::UniqueConnection);
 }
 
 void ResourceManager::store_jump(int page) {
@@ -386,18 +929,6 @@ void ResourceManager::inotify_slot() {
 #endif
 }
 
-void ResourceManager::enqueue(int page, int width, int index) {
-	requestMutex.lock();
-	map<int,Request>::iterator it = requests.find(page);
-	if (it == requests.end()) {
-		requests.insert(make_pair(page, Request(width, index)));
-		requestSemaphore.release(1);
-	} else {
-		it->second.update(width, index);
-	}
-	requestMutex.unlock();
-}
-
 //QString ResourceManager::get_page_label(int page) const {
 //	if (page < 0 || page >= get_page_count()) {
 //		return QString();
@@ -456,22 +987,36 @@ int ResourceManager::get_page_count() const {
 	return page_count;
 }
 
-const QList<Poppler::Link *> *ResourceManager::get_links(int page) {
+bool ResourceManager::are_page_sizes_loaded() const {
+	return sizes_loaded >= page_count;
+}
+
+const QList<Poppler::Link *> *ResourceManager::get_links(int page, bool wait) {
 	if (page < 0 || page >= get_page_count()) {
 		return NULL;
 	}
+	// the text thread may be busy with a long page, don't wait for it;
+	// doc is the gui thread's own
+	if (wait && text_worker != NULL) {
+		text_worker->extract(page, doc);
+	}
 	link_mutex.lock();
 	QList<Poppler::Link *> *l = k_page[page].links;
 	link_mutex.unlock();
 	return l;
 }
 
-const QList<SelectionLine *> *ResourceManager::get_text(int page) {
+const TextLayout *ResourceManager::get_text(int page, bool wait) {
 	if (page < 0 || page >= get_page_count()) {
 		return NULL;
 	}
+	// the text thread may be busy with a long page, don't wait for it;
+	// doc is the gui thread's own
+	if (wait && text_worker != NULL) {
+		text_worker->extract(page, doc);
+	}
 	link_mutex.lock();
-	QList<SelectionLine *> *t = k_page[page].text;
+	TextLayout *t = k_page[page].text;
 	link_mutex.unlock();
 	return t;
 }
@@ -484,8 +1029,27 @@ QDomDocument *ResourceManager::get_toc() const {
 }
 
 void ResourceManager::join_threads() {
-	worker->die = true;
-	requestSemaphore.release(1);
-	worker->wait();
+	if (reload_worker != NULL) {
+		reload_worker->die = true;
+	}
+	scheduler.shutdown();
+	if (text_worker != NULL) {
+		text_worker->stop();
+	}
+	for (vector<ThumbnailWorker *>::iterator it = thumbnail_workers.begin(); it != thumbnail_workers.end(); ++it) {
+		(*it)->die = true;
+	}
+	for (vector<Worker *>::iterator it = workers.begin(); it != workers.end(); ++it) {
+		(*it)->wait();
+	}
+	for (vector<ThumbnailWorker *>::iterator it = thumbnail_workers.begin(); it != thumbnail_workers.end(); ++it) {
+		(*it)->wait();
+	}
+	if (text_worker != NULL) {
+		text_worker->wait();
+	}
+	if (reload_worker != NULL) {
+		reload_worker->wait();
+	}
 }
 
@@ -4,9 +4,13 @@
 #include <QObject>
 #include <QString>
 #include <QImage>
+#include <QRect>
 #include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
 #include <QMutex>
-#include <QSemaphore>
+#include <QSharedPointer>
+#include <QAtomicInt>
 #if QT_VERSION >= 0x050000
 #	include <poppler-qt5.h>
 #else
@@ -14,28 +18,33 @@
 #endif
 #include <list>
 #include <set>
+#include <vector>
+#include "kpage.h"
+#include "diskcache.h"
+#include "scheduler.h"
 
 
 class ResourceManager;
 class Canvas;
-class KPage;
 class Worker;
+class TextWorker;
+class ThumbnailWorker;
+class ThumbnailAtlas;
+class ReloadWorker;
+class DocumentPool;
 class Viewer;
 class QSocketNotifier;
 class QDomDocument;
-class SelectionLine;
+class TextLayout;
 
 
-class Request {
-public:
-	Request(int width, int index);
+typedef std::pair<int, int> CacheKey; // page, index
 
-	int get_lowest_index();
-	bool has_index(int index);
-	bool remove_index_ok(int index);
-	void update(int width, int index);
 
-	int width[3];
+class CacheEntry {
+public:
+	std::list<CacheKey>::iterator lru_pos;
+	int bytes;
 };
 
 
@@ -55,7 +64,15 @@ public:
 	const QString &get_file() const;
 	void set_file(const QString &new_file);
 	// page (meta)data
-	const KPage *get_page(int page, int newWidth, int index);
+	// only visible pages get a low resolution preview
+	const KPage *get_page(int page, int newWidth, int index, Render::Priority priority = Render::Visible);
+	// the views of index are being zoomed or resized; until their size
+	// settles, images of a similar size are scaled instead of rendered again
+	void begin_resize(int index);
+	// requests the tiles covering rect (in pixels of the page rendered at width)
+	const KPage *get_tiles(int page, int width, const QRect &rect);
+	bool use_tiles(int width, int height) const;
+	int get_tile_size() const;
 //	QString get_page_label(int page) const;
 	float get_page_width(int page, bool rotated = true) const;
 	float get_page_height(int page, bool rotated = true) const;
@@ -63,8 +80,12 @@ public:
 	float get_min_aspect(bool rotated = true) const;
 	float get_max_aspect(bool rotated = true) const;
 	int get_page_count() const;
-	const QList<Poppler::Link *> *get_links(int page);
-	const QList<SelectionLine *> *get_text(int page);
+	// false while sizes are still read in the background
+	bool are_page_sizes_loaded() const;
+	// links and text are extracted in the background; with wait, missing ones
+	// are extracted right away instead of returning NULL (gui thread only)
+	const QList<Poppler::Link *> *get_links(int page, bool wait = false);
+	const TextLayout *get_text(int page, bool wait = false);
 	QDomDocument *get_toc() const;
 
 	int get_rotation() const;
@@ -73,7 +94,17 @@ public:
 	void invert_colors();
 	bool are_colors_inverted() const;
 
-	void collect_garbage(int keep_min, int keep_max, int index);
+	// render requests outside [keep_min, keep_max] are dropped; when the cache
+	// is full, only the pages in [visible_min, visible_max] are never evicted
+	void collect_garbage(int keep_min, int keep_max, int index, int visible_min, int visible_max);
+	// pages, tiles and thumbnails
+	qint64 get_cache_size();
+	// tiles are stored by the workers and counted against the cache size
+	void add_tile_bytes(int bytes);
+	SchedulerStats get_render_stats();
+	const DiskCache *get_disk_cache() const;
+	// copies of the document for threads, NULL if it can't be rendered
+	QSharedPointer<DocumentPool> get_documents() const;
 
 	void connect_canvas() const;
 
@@ -87,33 +118,83 @@ public:
 public slots:
 	void inotify_slot();
 
+signals:
+	void page_sizes_changed(int first, int last);
+	// the exact sizes are needed now
+	void resize_settled();
+	// an unchanged page got its images back after a reload
+	void page_rendered(int page);
+
+private slots:
+	void load_page_sizes();
+	// the reload worker found a page that did not change
+	void adopt_unchanged(int page);
+	void finish_reload();
+
 private:
-	void enqueue(int page, int width, int index = 0);
+	// image cache
+	void cache_insert(int page, int index);
+	bool is_resizing(int index) const;
+
+	void cache_touch(int page, int index);
+	void cache_evict();
+
+	// makes a thumbnail from a rendered page unless it already has one
+	bool set_thumbnail(int page, const QImage &img, int rotation);
 
 	void initialize(const QString &file, const QByteArray &password);
+	// moves the images, links and text of an unchanged page over from the
+	// previous document, keeps what was rendered since
+	void adopt_page(int page);
 	void join_threads();
 	void shutdown();
 
 	// sadly, poppler's renderToImage only supports one thread per document
-	Worker *worker;
+	// -> the threads borrow documents from this pool, doc is the gui's
+	QSharedPointer<DocumentPool> documents;
+	std::vector<Worker *> workers;
+	TextWorker *text_worker;
+	std::vector<ThumbnailWorker *> thumbnail_workers;
+	ReloadWorker *reload_worker;
+	KPage *reload_k_page; // the previous document's pages
 
 	Viewer *viewer;
 
 	QString file;
+	QString doc_file; // the file doc was loaded from
 	Poppler::Document *doc;
-	QMutex requestMutex;
 	QMutex garbageMutex;
-	QSemaphore requestSemaphore;
-	int center_page;
+	Scheduler scheduler;
 	float max_aspect;
 	float min_aspect;
-	std::map<int, Request> requests; // page, index, width
-	std::set<int> garbage[3];
+	// pages from sizes_loaded on still have the first page's size
+	QTimer size_timer;
+	int sizes_loaded;
+	bool sizes_differ;
+	DiskCache disk_cache;
+	std::set<int> tile_garbage;
+	// resolution ladder
+	QElapsedTimer resized[render_index_count];
+	QTimer settle_timer;
+	// rendered images, least recently used first
+	std::list<CacheKey> lru;
+	std::map<CacheKey, CacheEntry> cache;
+	qint64 cache_bytes;
+	QAtomicInt tile_bytes;
+	int visible_min[render_index_count];
+	int visible_max[render_index_count];
+	int prefetch_min[render_index_count]; // last keep range of collect_garbage()
+	int prefetch_max[render_index_count];
 	QMutex link_mutex;
+	ThumbnailAtlas *thumbnails;
 
 	KPage *k_page;
 
 	friend class Worker;
+	friend class TextWorker;
+	friend class ThumbnailWorker;
+	friend class ReloadWorker;
+	friend class SearchWorker;
 
 	int page_count;
 	int rotation;
@@ -126,6 +207,16 @@ private:
 
 	bool inverted_colors;
 
+	// config options
+	float preview_scale;
+	int settle_time; // ms
+	int tile_size;
+	float tile_threshold; // pixels
+	qint64 cache_limit; // bytes
+	bool smooth_downscaling;
+	int thumbnail_size;
+	int thumbnail_threads;
+
 	std::list<int> jumplist;
 	std::map<int,std::list<int>::iterator> jump_map;
 	std::list<int>::iterator cur_jump_pos;
@@ -0,0 +1,445 @@
+#include "scheduler.h"
+#include <limits>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+
+//==[ RenderJob ]==============================================================
+RenderJob::RenderJob() :
+		kind(Page),
+		page(0),
+		index(0),
+		width(0),
+		tile(0, 0, 0, 0),
+		requesters(1) {
+}
+
+RenderJob::RenderJob(Kind kind, int page, int index, int width) :
+		kind(kind),
+		page(page),
+		index(index),
+		width(width),
+		tile(0, 0, 0, 0),
+		requesters(1 << index) {
+}
+
+RenderJob::RenderJob(int page, const TileKey &tile) :
+		kind(Tile),
+		page(page),
+		index(0),
+		width(tile.width),
+		tile(tile),
+		requesters(1) {
+}
+
+bool RenderJob::operator<(const RenderJob &other) const {
+	if (page != other.page) {
+		return page < other.page;
+	}
+	if (kind != other.kind) {
+		return kind < other.kind;
+	}
+	if (index != other.index) {
+		return index < other.index;
+	}
+	if (kind != Tile) {
+		return false;
+	}
+	return tile < other.tile;
+}
+
+
+//==[ SchedulerStats ]=========================================================
+SchedulerStats::SchedulerStats() :
+		cancelled(0),
+		aborted(0) {
+	for (int i = 0; i < Render::priority_count; i++) {
+		depth[i] = 0;
+		started[i] = 0;
+		total_wait[i] = 0;
+		max_wait[i] = 0;
+	}
+}
+
+
+//==[ Scheduler ]==============================================================
+// returns the job closest to center_page; jobs must not be empty
+static set<RenderJob>::iterator find_closest(set<RenderJob> &jobs, int center_page) {
+	RenderJob first(RenderJob::Preview, center_page, numeric_limits<int>::min(), 0);
+	set<RenderJob>::iterator greater = jobs.lower_bound(first);
+	if (greater == jobs.begin()) {
+		return greater;
+	}
+	set<RenderJob>::iterator less = greater;
+	--less;
+	if (greater == jobs.end()) {
+		return less;
+	}
+	// favour nearby page, go down first
+	if (greater->page + less->page <= center_page * 2) {
+		return greater;
+	} else {
+		return less;
+	}
+}
+
+Scheduler::Entry::Entry() :
+		priority(Render::Speculative),
+		width(0),
+		requested(0) {
+	for (int i = 0; i < render_index_count; i++) {
+		frame[i] = -1;
+	}
+}
+
+Scheduler::Scheduler() :
+		stopped(false) {
+	for (int i = 0; i < render_index_count; i++) {
+		frame[i] = 0;
+		keep_min[i] = 0;
+		keep_max[i] = -1;
+		center_page[i] = 0;
+	}
+	clock.start();
+}
+
+void Scheduler::enqueue(const RenderJob &job, Render::Priority priority) {
+	mutex.lock();
+	map<RenderJob,Entry>::iterator it = jobs.find(job);
+	// the views of the jobs this one replaces
+	Entry merged;
+	if (job.kind == RenderJob::Page) {
+		for (int i = 0; i < render_index_count; i++) {
+			if (i == job.index) {
+				continue;
+			}
+			map<RenderJob,Entry>::iterator other = jobs.find(RenderJob(RenderJob::Page, job.page, i, 0));
+			if (other == jobs.end()) {
+				continue;
+			}
+			int other_width = other->second.width;
+			if (other_width >= job.width && other_width <= job.width * max_share_scale) {
+				// the other view's image gets scaled down for this one
+				promote(other, priority);
+				if (it != jobs.end()) {
+					merge_requesters(other->second, it->second);
+					remove(it);
+				}
+				merge_requesters(other->second, merged);
+				other->second.frame[job.index] = frame[job.index];
+				mutex.unlock();
+				return;
+			}
+			if (job.width > other_width && job.width <= other_width * max_share_scale) {
+				// this image gets scaled down for the other view
+				if (other->second.priority < priority) {
+					priority = other->second.priority;
+				}
+				merge_requesters(merged, other->second);
+				remove(other);
+			}
+		}
+	}
+	if (it == jobs.end()) {
+		Entry entry = merged;
+		entry.priority = priority;
+		entry.width = job.width;
+		entry.frame[job.index] = frame[job.index];
+		entry.requested = clock.elapsed();
+		jobs.insert(make_pair(job, entry));
+		queues[priority][job.kind][job.index].insert(job);
+		job_available.wakeOne();
+		mutex.unlock();
+		return;
+	}
+
+	Entry &entry = it->second;
+	merge_requesters(entry, merged);
+	// a page can be requested as visible and as prefetched in the same frame
+	if (entry.frame[job.index] != frame[job.index] || priority < entry.priority) {
+		if (entry.priority != priority) {
+			if (priority < entry.priority) {
+				entry.requested = clock.elapsed();
+			}
+			queues[entry.priority][job.kind][job.index].erase(job);
+			queues[priority][job.kind][job.index].insert(job);
+			entry.priority = priority;
+		}
+	}
+	entry.width = job.width;
+	entry.frame[job.index] = frame[job.index];
+	mutex.unlock();
+}
+
+bool Scheduler::pop(RenderJob &job, Render::Priority &priority) {
+	mutex.lock();
+	while (!stopped) {
+		for (int p = 0; p < Render::priority_count; p++) {
+			for (int kind = 0; kind < 3; kind++) {
+				// the job closest to the center of its view
+				set<RenderJob>::iterator closest;
+				int closest_distance = -1;
+				for (int i = 0; i < render_index_count; i++) {
+					set<RenderJob> &queue = queues[p][kind][i];
+					if (queue.empty()) {
+						continue;
+					}
+					set<RenderJob>::iterator candidate = find_closest(queue, center_page[i]);
+					int distance = abs(candidate->page - center_page[i]);
+					if (closest_distance == -1 || distance < closest_distance) {
+						closest = candidate;
+						closest_distance = distance;
+					}
+				}
+				if (closest_distance == -1) {
+					continue;
+				}
+				map<RenderJob,Entry>::iterator it = jobs.find(*closest);
+				job = it->first;
+				job.width = it->second.width;
+				job.requesters = get_requesters(it->second);
+				priority = static_cast<Render::Priority>(p);
+
+				qint64 wait = clock.elapsed() - it->second.requested;
+				stats.started[p]++;
+				stats.total_wait[p] += wait;
+				if (wait > stats.max_wait[p]) {
+					stats.max_wait[p] = wait;
+				}
+
+				remove(it);
+				mutex.unlock();
+				return true;
+			}
+		}
+		job_available.wait(&mutex);
+	}
+	mutex.unlock();
+	return false;
+}
+
+bool Scheduler::is_cancelled(const RenderJob &job) {
+	mutex.lock();
+	bool cancelled = true;
+	for (int i = 0; i < render_index_count; i++) {
+		if ((job.requesters & (1 << i)) == 0) {
+			continue;
+		}
+		if (keep_min[i] > keep_max[i] || (job.page >= keep_min[i] && job.page <= keep_max[i])) {
+			cancelled = false;
+		}
+	}
+	mutex.unlock();
+	return cancelled;
+}
+
+bool Scheduler::is_waiting(Render::Priority priority) {
+	mutex.lock();
+	bool waiting = false;
+	for (int kind = 0; kind < 3; kind++) {
+		for (int i = 0; i < render_index_count; i++) {
+			if (!queues[priority][kind][i].empty()) {
+				waiting = true;
+			}
+		}
+	}
+	mutex.unlock();
+	return waiting;
+}
+
+bool Scheduler::is_idle() {
+	mutex.lock();
+	bool idle = jobs.empty();
+	mutex.unlock();
+	return idle;
+}
+
+void Scheduler::abort(const RenderJob &job, Render::Priority priority, bool retry) {
+	mutex.lock();
+	stats.aborted++;
+	// a newer request takes precedence
+	bool queued = jobs.find(job) != jobs.end();
+	mutex.unlock();
+	if (retry && !queued) {
+		enqueue(job, priority);
+		// the other views still want it as well
+		mutex.lock();
+		map<RenderJob,Entry>::iterator it = jobs.find(job);
+		if (it != jobs.end()) {
+			for (int i = 0; i < render_index_count; i++) {
+				if ((job.requesters & (1 << i)) != 0 && it->second.frame[i] == -1) {
+					it->second.frame[i] = frame[i];
+				}
+			}
+		}
+		mutex.unlock();
+	}
+}
+
+void Scheduler::set_center(int index, int page) {
+	mutex.lock();
+	center_page[index] = page;
+	mutex.unlock();
+}
+
+int Scheduler::get_center(int index) {
+	mutex.lock();
+	int page = center_page[index];
+	mutex.unlock();
+	return page;
+}
+
+void Scheduler::end_frame(int index) {
+	mutex.lock();
+	for (map<RenderJob,Entry>::iterator it = jobs.begin(); it != jobs.end(); ) {
+		const RenderJob &job = it->first;
+		Entry &entry = it->second;
+		if (entry.frame[index] == -1 || entry.frame[index] >= frame[index] - 1) {
+			++it;
+			continue;
+		}
+		// still requested by another view
+		bool stale = true;
+		for (int i = 0; i < render_index_count; i++) {
+			if (entry.frame[i] != -1 && entry.frame[i] >= frame[i] - 1) {
+				stale = false;
+			}
+		}
+		if (!stale) {
+			++it;
+			continue;
+		}
+		if (job.kind != RenderJob::Page) {
+			stats.cancelled++;
+			remove(it++);
+			continue;
+		}
+		if (entry.priority != Render::Speculative) {
+			queues[entry.priority][job.kind][job.index].erase(job);
+			queues[Render::Speculative][job.kind][job.index].insert(job);
+			entry.priority = Render::Speculative;
+		}
+		++it;
+	}
+	frame[index]++;
+	mutex.unlock();
+}
+
+void Scheduler::cancel_outside(int index, int min, int max) {
+	mutex.lock();
+	keep_min[index] = min;
+	keep_max[index] = max;
+	for (map<RenderJob,Entry>::iterator it = jobs.begin(); it != jobs.end(); ) {
+		Entry &entry = it->second;
+		if (entry.frame[index] == -1 || (it->first.page >= min && it->first.page <= max)) {
+			++it;
+			continue;
+		}
+		entry.frame[index] = -1;
+		if (get_requesters(entry) == 0) {
+			stats.cancelled++;
+			remove(it++);
+		} else {
+			++it;
+		}
+	}
+	mutex.unlock();
+}
+
+void Scheduler::set_tiles(int page, const set<TileKey> &tiles) {
+	mutex.lock();
+	// drop the outdated ones
+	map<RenderJob,Entry>::iterator it = jobs.lower_bound(RenderJob(RenderJob::Tile, page, 0, 0));
+	while (it != jobs.end() && it->first.page == page && it->first.kind == RenderJob::Tile) {
+		if (tiles.find(it->first.tile) == tiles.end()) {
+			stats.cancelled++;
+			remove(it++);
+		} else {
+			++it;
+		}
+	}
+	mutex.unlock();
+
+	for (set<TileKey>::const_iterator t = tiles.begin(); t != tiles.end(); ++t) {
+		enqueue(RenderJob(page, *t), Render::Visible);
+	}
+}
+
+void Scheduler::shutdown() {
+	mutex.lock();
+	stopped = true;
+	job_available.wakeAll();
+	mutex.unlock();
+}
+
+void Scheduler::reset() {
+	mutex.lock();
+	jobs.clear();
+	for (int priority = 0; priority < Render::priority_count; priority++) {
+		for (int kind = 0; kind < 3; kind++) {
+			for (int i = 0; i < render_index_count; i++) {
+				queues[priority][kind][i].clear();
+			}
+		}
+	}
+	for (int i = 0; i < render_index_count; i++) {
+		frame[i] = 0;
+		keep_min[i] = 0;
+		keep_max[i] = -1;
+		center_page[i] = 0;
+	}
+	stopped = false;
+	stats = SchedulerStats();
+	mutex.unlock();
+}
+
+SchedulerStats Scheduler::get_stats() {
+	mutex.lock();
+	SchedulerStats s = stats;
+	for (int priority = 0; priority < Render::priority_count; priority++) {
+		s.depth[priority] = 0;
+		for (int kind = 0; kind < 3; kind++) {
+			for (int i = 0; i < render_index_count; i++) {
+				s.depth[priority] += queues[priority][kind][i].size();
+			}
+		}
+	}
+	mutex.unlock();
+	return s;
+}
+
+void Scheduler::merge_requesters(Entry &to, const Entry &from) {
+	for (int i = 0; i < render_index_count; i++) {
+		to.frame[i] = max(to.frame[i], from.frame[i]);
+	}
+}
+
+int Scheduler::get_requesters(const Entry &entry) {
+	int mask = 0;
+	for (int i = 0; i < render_index_count; i++) {
+		if (entry.frame[i] != -1) {
+			mask |= 1 << i;
+		}
+	}
+	return mask;
+}
+
+// mutex must be locked
+void Scheduler::remove(map<RenderJob,Entry>::iterator it) {
+	queues[it->second.priority][it->first.kind][it->first.index].erase(it->first);
+	jobs.erase(it);
+}
+
+// mutex must be locked
+void Scheduler::promote(map<RenderJob,Entry>::iterator it, Render::Priority priority) {
+	Entry &entry = it->second;
+	if (priority < entry.priority) {
+		queues[entry.priority][it->first.kind][it->first.index].erase(it->first);
+		queues[priority][it->first.kind][it->first.index].insert(it->first);
+		entry.priority = priority;
+		entry.requested = clock.elapsed();
+	}
+}
+
@@ -0,0 +1,137 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <map>
+#include <set>
+#include "kpage.h"
+
+
+namespace Render {
+	enum Priority {
+		Visible,
+		Prefetch,
+		Speculative
+	};
+
+	const int priority_count = 3;
+}
+
+
+class RenderJob {
+public:
+	// jobs of the same priority are started in this order
+	enum Kind {
+		Preview,
+		Tile,
+		Page
+	};
+
+	RenderJob();
+	RenderJob(Kind kind, int page, int index, int width);
+	RenderJob(int page, const TileKey &tile);
+
+	// orders by page first; the width is not part of a job's identity
+	bool operator<(const RenderJob &other) const;
+
+	Kind kind;
+	int page;
+	int index; // the view whose image slot receives the result
+	int width;
+	TileKey tile;
+	// bit mask of the views that want the job, filled in by pop()
+	int requesters;
+};
+
+
+class SchedulerStats {
+public:
+	SchedulerStats();
+
+	int depth[Render::priority_count]; // queued jobs
+	int started[Render::priority_count];
+	int cancelled;
+	int aborted; // while rendering
+	// time between a job reaching its priority and its start
+	qint64 total_wait[Render::priority_count]; // ms
+	qint64 max_wait[Render::priority_count];
+};
+
+
+// render jobs ordered by priority, then kind, then distance to the center
+// page of the view (index) they were requested for
+class Scheduler {
+public:
+	Scheduler();
+
+	// adds a job or moves an existing one to the new priority; a page is
+	// rendered once for all views that can scale it down from the largest size
+	void enqueue(const RenderJob &job, Render::Priority priority);
+	// blocks until there is a job, returns false after shutdown()
+	bool pop(RenderJob &job, Render::Priority &priority);
+	// a running job is cancelled when its page left the range of cancel_outside()
+	// of every view that wanted it
+	bool is_cancelled(const RenderJob &job);
+	// are jobs of this priority waiting for a worker?
+	bool is_waiting(Render::Priority priority);
+	// no jobs are waiting at all
+	bool is_idle();
+	// the worker stopped rendering job, retry queues it again
+	void abort(const RenderJob &job, Render::Priority priority, bool retry);
+
+	// the page the view index is focused on
+	void set_center(int index, int page);
+	int get_center(int index = 0);
+	// called after every frame: jobs that none of their views requested during
+	// the last two frames are stale, pages become speculative, previews and
+	// tiles are dropped
+	void end_frame(int index);
+	// index stops wanting the jobs outside [min, max], they are dropped unless
+	// another view still wants them
+	void cancel_outside(int index, int min, int max);
+	// replaces the tile jobs of page
+	void set_tiles(int page, const std::set<TileKey> &tiles);
+
+	void shutdown();
+	// drops all jobs and undoes shutdown()
+	void reset();
+
+	SchedulerStats get_stats();
+
+private:
+	class Entry {
+	public:
+		Entry();
+
+		Render::Priority priority;
+		int width;
+		// of the last request per view, -1 if the view does not want the job
+		int frame[render_index_count];
+		qint64 requested; // ms, when the job got its current priority
+	};
+
+	// takes over the views that want from
+	static void merge_requesters(Entry &to, const Entry &from);
+	static int get_requesters(const Entry &entry);
+	void remove(std::map<RenderJob,Entry>::iterator it);
+	// raises the priority of a queued job
+	void promote(std::map<RenderJob,Entry>::iterator it, Render::Priority priority);
+
+	std::map<RenderJob,Entry> jobs;
+	std::set<RenderJob> queues[Render::priority_count][3][render_index_count]; // priority, kind, index
+	int frame[render_index_count]; // per index
+	int keep_min[render_index_count]; // last range of cancel_outside()
+	int keep_max[render_index_count];
+	int center_page[render_index_count];
+	bool stopped;
+	SchedulerStats stats;
+
+	QMutex mutex;
+	QWaitCondition job_available;
+	QElapsedTimer clock;
+};
+
+#endif
+
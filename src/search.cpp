@@ -1,24 +1,52 @@
 #include <iostream>
+#include <algorithm>
 #include "search.h"
 #include "canvas.h"
 #include "viewer.h"
 #include "config.h"
 #include "util.h"
 #include "resourcemanager.h"
+#include "searchindex.h"
+#include "profiler.h"
+#include "documentpool.h"
 #include "layout/layout.h"
 
 using namespace std;
 
 
+// how long to step back while visible pages are waiting to be rendered
+static const unsigned long idle_poll = 100; // ms
+
+
 //==[ SearchWorker ]===========================================================
-SearchWorker::SearchWorker(SearchBar *_bar) :
+SearchWorker::SearchWorker(SearchBar *_bar, int _id) :
 		stop(false),
 		die(false),
 		bar(_bar),
+		id(_id),
 		forward(true) {
 }
 
 void SearchWorker::run() {
+	if (id == 0) {
+		if (bar->index != NULL && !bar->index_path.isEmpty()) {
+			bar->index->load(bar->index_path);
+		}
+		coordinate();
+		return;
+	}
+
+	bar->job_mutex.lock();
+	while (!die) {
+		// searching comes first, build the index in idle time
+		if (!search_next_page() && !index_next_page()) {
+			bar->job_available.wait(&bar->job_mutex);
+		}
+	}
+	bar->job_mutex.unlock();
+}
+
+void SearchWorker::coordinate() {
 	while (1) {
 		bar->search_mutex.lock();
 		stop = false;
@@ -56,52 +84,65 @@ void SearchWorker::run() {
 		emit update_label_text(QString::fromUtf8("[%1] 0\% searched, 0 hits")
 			.arg(has_upper_case ? QString::fromUtf8("Case") : QString::fromUtf8("no case")));
 
-		// search all pages
-		int hit_count = 0;
-		int page = start;
-		do {
-			Poppler::Page *p = bar->doc->page(page);
-			if (p == NULL) {
-				cerr << "failed to load page " << page << endl;
-				continue;
+		int page_count = bar->page_count;
+		if (bar->index != NULL && bar->index->is_complete()) {
+			// every page is indexed, no need to go through them
+			map<int,QList<QRectF> *> index_hits = bar->index->search(search_term, has_upper_case);
+			vector<pair<int, int> > order; // distance in search order, page
+			for (map<int,QList<QRectF> *>::iterator it = index_hits.begin(); it != index_hits.end(); ++it) {
+				int distance = forward ? it->first - start : start - it->first;
+				order.push_back(make_pair((distance + page_count) % page_count, it->first));
 			}
-
-			// collect all occurrences
-			QList<QRectF> *hits = new QList<QRectF>;
-#if POPPLER_VERSION < POPPLER_VERSION_CHECK(0, 22, 0)
-			// old search interface, slow for many hits per page
-			double x = 0, y = 0, x2 = 0, y2 = 0;
-			while (!stop && !die &&
-					p->search(search_term, x, y, x2, y2, Poppler::Page::NextResult,
-						has_upper_case ? Poppler::Page::CaseSensitive : Poppler::Page::CaseInsensitive)) {
-				hits->push_back(QRectF(x, y, x2 - x, y2 - y));
+			sort(order.begin(), order.end());
+
+			int hit_count = 0;
+			for (vector<pair<int, int> >::iterator it = order.begin(); it != order.end(); ++it) {
+				QList<QRectF> *hits = index_hits[it->second];
+				if (stop || die) {
+					delete hits;
+					continue;
+				}
+				hit_count += hits->size();
+				emit search_done(it->second, hits);
 			}
-#elif POPPLER_VERSION < POPPLER_VERSION_CHECK(0, 31, 0)
-			// new search interface
-			QList<QRectF> tmp = p->search(search_term,
-					has_upper_case ? Poppler::Page::CaseSensitive : Poppler::Page::CaseInsensitive);
-			hits->swap(tmp);
-#else
-			// even newer interface
-			QList<QRectF> tmp = p->search(search_term,
-					has_upper_case ? (Poppler::Page::SearchFlags) 0 : Poppler::Page::IgnoreCase);
-			// TODO support Poppler::Page::WholeWords
-			hits->swap(tmp);
-#endif
-#ifdef DEBUG
-			if (hits->size() > 0) {
-				cerr << hits->size() << " hits on page " << page << endl;
+			if (!stop && !die) {
+				emit update_label_text(QString::fromUtf8("[%1] done, %2 hits")
+						.arg(has_upper_case ? QString::fromUtf8("Case") : QString::fromUtf8("no case"))
+						.arg(hit_count));
 			}
-#endif
-			delete p;
+			continue;
+		}
 
-			// clean up when interrupted
-			if (stop || die) {
-				delete hits;
-				break;
+		// hand the pages out to all workers
+		bar->job_mutex.lock();
+		bar->job_id++;
+		bar->job_active = true;
+		bar->job_term = search_term;
+		bar->job_case_sensitive = has_upper_case;
+		bar->job_start = start;
+		bar->job_forward = forward;
+		bar->job_next = 0;
+		bar->job_hits.assign(page_count, (QList<QRectF> *) NULL);
+		bar->job_done.assign(page_count, false);
+		bar->job_available.wakeAll();
+
+		// deliver the hits in search order, help out while waiting
+		int hit_count = 0;
+		int index = 0;
+		while (index < page_count && !stop && !die) {
+			if (!bar->job_done[index]) {
+				if (!search_next_page()) {
+					bar->page_searched.wait(&bar->job_mutex);
+				}
+				continue;
 			}
+			QList<QRectF> *hits = bar->job_hits[index];
+			bar->job_hits[index] = NULL;
+			int page = forward ? (start + index) % page_count : (start - index + page_count) % page_count;
+			index++;
+			bar->job_mutex.unlock();
 
-			if (hits->size() > 0) {
+			if (hits != NULL && hits->size() > 0) {
 				hit_count += hits->size();
 				emit search_done(page, hits);
 			} else {
@@ -109,29 +150,26 @@ void SearchWorker::run() {
 			}
 
 			// update progress label next to the search bar
-			int percent;
-			if (forward) {
-				percent = page + bar->doc->numPages() - start;
-			} else {
-				percent = start + bar->doc->numPages() - page;
-			}
-			percent = (percent % bar->doc->numPages()) * 100 / bar->doc->numPages();
 			QString progress = QString::fromUtf8("[%1] %2\% searched, %3 hits")
 				.arg(has_upper_case ? QString::fromUtf8("Case") : QString::fromUtf8("no case"))
-				.arg(percent)
+				.arg(index * 100 / page_count)
 				.arg(hit_count);
 			emit update_label_text(progress);
 
-			if (forward) {
-				if (++page == bar->doc->numPages()) {
-					page = 0;
-				}
-			} else {
-				if (--page == -1) {
-					page = bar->doc->numPages() - 1;
-				}
-			}
-		} while (page != start);
+			bar->job_mutex.lock();
+		}
+
+		// clean up when interrupted
+		bar->job_active = false;
+		for (vector<QList<QRectF> *>::iterator it = bar->job_hits.begin(); it != bar->job_hits.end(); ++it) {
+			delete *it;
+		}
+		bar->job_hits.clear();
+		bar->job_done.clear();
+		bar->job_mutex.unlock();
+		if (stop || die) {
+			continue;
+		}
 #ifdef DEBUG
 		cerr << "done!" << endl;
 #endif
@@ -141,9 +179,145 @@ void SearchWorker::run() {
 	}
 }
 
+// searches the next page of the running search; job_mutex must be locked
+// returns false if there is nothing left to do
+bool SearchWorker::search_next_page() {
+	if (!bar->job_active || bar->job_next >= (int) bar->job_done.size()) {
+		return false;
+	}
+	int job = bar->job_id;
+	int index = bar->job_next++;
+	int page_count = bar->job_done.size();
+	int page;
+	if (bar->job_forward) {
+		page = (bar->job_start + index) % page_count;
+	} else {
+		page = (bar->job_start - index + page_count) % page_count;
+	}
+	QString search_term = bar->job_term;
+	bool case_sensitive = bar->job_case_sensitive;
+	bar->job_mutex.unlock();
+
+	qint64 start = Profiler::get_instance()->begin();
+	QList<QRectF> *hits = search_page(page, search_term, case_sensitive);
+	Profiler::get_instance()->end(Profile::Search, start);
+
+	bar->job_mutex.lock();
+	if (bar->job_active && bar->job_id == job) {
+		bar->job_hits[index] = hits;
+		bar->job_done[index] = true;
+		bar->page_searched.wakeAll();
+	} else {
+		delete hits;
+	}
+	return true;
+}
+
+// indexes the next page not needed by a search; job_mutex must be locked
+// returns false if there is nothing left to do
+bool SearchWorker::index_next_page() {
+	// one thread is enough in the background, searches index the pages they
+	// go through anyway
+	if (id != 1 || bar->index == NULL || bar->index_next >= bar->page_count) {
+		return false;
+	}
+	// the visible pages come first
+	if (bar->viewer->get_res()->scheduler.is_waiting(Render::Visible)) {
+		bar->job_available.wait(&bar->job_mutex, idle_poll);
+		return true;
+	}
+	int page = bar->index_next++;
+	bar->job_mutex.unlock();
+
+	index_page(page);
+
+	bar->job_mutex.lock();
+	return true;
+}
+
+QList<QRectF> *SearchWorker::search_page(int page, const QString &search_term, bool case_sensitive) {
+	if (bar->index != NULL) {
+		if (!index_page(page)) {
+			return NULL;
+		}
+		return bar->index->search_page(page, search_term, case_sensitive);
+	}
+
+	Poppler::Document *doc = bar->documents->acquire();
+	if (doc == NULL) {
+		return NULL;
+	}
+	Poppler::Page *p = doc->page(page);
+	if (p == NULL) {
+		cerr << "failed to load page " << page << endl;
+		bar->documents->release(doc);
+		return NULL;
+	}
+
+	// collect all occurrences
+	QList<QRectF> *hits = new QList<QRectF>;
+#if POPPLER_VERSION < POPPLER_VERSION_CHECK(0, 22, 0)
+	// old search interface, slow for many hits per page
+	double x = 0, y = 0, x2 = 0, y2 = 0;
+	while (!bar->workers[0]->stop && !die &&
+			p->search(search_term, x, y, x2, y2, Poppler::Page::NextResult,
+				case_sensitive ? Poppler::Page::CaseSensitive : Poppler::Page::CaseInsensitive)) {
+		hits->push_back(QRectF(x, y, x2 - x, y2 - y));
+	}
+#elif POPPLER_VERSION < POPPLER_VERSION_CHECK(0, 31, 0)
+	// new search interface
+	QList<QRectF> tmp = p->search(search_term,
+			case_sensitive ? Poppler::Page::CaseSensitive : Poppler::Page::CaseInsensitive);
+	hits->swap(tmp);
+#else
+	// even newer interface
+	QList<QRectF> tmp = p->search(search_term,
+			case_sensitive ? (Poppler::Page::SearchFlags) 0 : Poppler::Page::IgnoreCase);
+	// TODO support Poppler::Page::WholeWords
+	hits->swap(tmp);
+#endif
+#ifdef DEBUG
+	if (hits->size() > 0) {
+		cerr << hits->size() << " hits on page " << page << endl;
+	}
+#endif
+	delete p;
+	bar->documents->release(doc);
+	return hits;
+}
+
+// adds the page to the index, unless it is already there
+bool SearchWorker::index_page(int page) {
+	if (bar->index->has_page(page)) {
+		return true;
+	}
+	Poppler::Document *doc = bar->documents->acquire();
+	if (doc == NULL) {
+		return false;
+	}
+	Poppler::Page *p = doc->page(page);
+	if (p == NULL) {
+		cerr << "failed to load page " << page << endl;
+		bar->documents->release(doc);
+		return false;
+	}
+	QList<Poppler::TextBox *> text = p->textList();
+	bool completed = bar->index->add_page(page, text);
+	Q_FOREACH(Poppler::TextBox *box, text) {
+		delete box;
+	}
+	delete p;
+	bar->documents->release(doc);
+
+	if (completed && !bar->index_path.isEmpty()) {
+		bar->index->save(bar->index_path);
+	}
+	return true;
+}
+
 
 //==[ SearchBar ]==============================================================
-SearchBar::SearchBar(const QString &file, Viewer *v, QWidget *parent) :
+SearchBar::SearchBar(Viewer *v, QWidget *parent) :
 		QWidget(parent),
 		viewer(v) {
 	setSizePolicy(QSizePolicy::Preferred, QSizePolicy::Fixed);
@@ -159,39 +333,46 @@ SearchBar::SearchBar(const QString &file, Viewer *v, QWidget *parent) :
 	layout->addWidget(progress);
 	setLayout(layout);
 
-	initialize(file, QByteArray());
+	initialize();
 }
 
-void SearchBar::initialize(const QString &file, const QByteArray &password) {
-	worker = NULL;
+void SearchBar::initialize() {
+	job_id = 0;
+	job_active = false;
+	index = NULL;
+	index_path = QString();
+	index_next = 0;
+	// the resource manager already reported why the document can't be opened
+	documents = viewer->get_res()->get_documents();
+	page_count = viewer->get_res()->get_page_count();
+	if (documents.isNull()) {
+		return;
+	}
 
-	doc = NULL;
-//	if (!file.isNull()) { // don't print the poppler error message for the second time
-	if (!file.isEmpty()) {
-		doc = Poppler::Document::load(file, QByteArray(), password);
+	if (CFG::get_instance()->get_value("Settings/search_index").toBool()) {
+		index = new SearchIndex(page_count);
+		index_path = viewer->get_res()->get_disk_cache()->get_index_path();
 	}
 
-	if (doc == NULL) {
-		// poppler already prints a debug message
-		return;
+	int thread_count = CFG::get_instance()->get_value("Settings/search_threads").toInt();
+	if (thread_count <= 0) {
+		thread_count = QThread::idealThreadCount();
 	}
-	if (doc->isLocked()) {
-		// poppler already prints a debug message
-//		cerr << "missing password" << endl;
-		delete doc;
-		doc = NULL;
-		return;
+	if (thread_count <= 0) { // could not be detected
+		thread_count = 1;
+	}
+	for (int i = 0; i < thread_count; i++) {
+		workers.push_back(new SearchWorker(this, i));
+		workers.back()->start(QThread::LowPriority);
 	}
-	worker = new SearchWorker(this);
-	worker->start();
 
 	connect(line, SIGNAL(returnPressed()), this, SLOT(set_text()),
 			Qt::UniqueConnection);
-	connect(worker, SIGNAL(update_label_text(const QString &)),
+	connect(workers[0], SIGNAL(update_label_text(const QString &)),
 			progress, SLOT(setText(const QString &)), Qt::UniqueConnection);
-	connect(worker, SIGNAL(search_done(int, QList<QRectF> *)),
+	connect(workers[0], SIGNAL(search_done(int, QList<QRectF> *)),
 			this, SLOT(insert_hits(int, QList<QRectF> *)), Qt::UniqueConnection);
-	connect(worker, SIGNAL(clear_hits()),
+	connect(workers[0], SIGNAL(clear_hits()),
 			this, SLOT(clear_hits()), Qt::UniqueConnection);
 }
 
@@ -203,23 +384,25 @@ SearchBar::~SearchBar() {
 }
 
 void SearchBar::shutdown() {
-	if (worker != NULL) {
+	if (!workers.empty()) {
 		join_threads();
 	}
-	if (doc == NULL) {
-		return;
+	for (vector<SearchWorker *>::iterator it = workers.begin(); it != workers.end(); ++it) {
+		delete *it;
 	}
-	delete doc;
-	delete worker;
+	workers.clear();
+	delete index;
+	index = NULL;
+	documents.clear();
 }
 
-void SearchBar::load(const QString &file, const QByteArray &password) {
+void SearchBar::load() {
 	shutdown();
-	initialize(file, password);
+	initialize();
 }
 
 bool SearchBar::is_valid() const {
-	return doc != NULL;
+	return !documents.isNull();
 }
 
 void SearchBar::focus(bool forward) {
@@ -306,14 +489,25 @@ void SearchBar::set_text() {
 	term = line->text();
 	term_mutex.unlock();
 
-	worker->stop = true;
+	job_mutex.lock();
+	workers[0]->stop = true;
+	page_searched.wakeAll();
+	job_mutex.unlock();
 	search_mutex.unlock();
 	c->setFocus(Qt::OtherFocusReason);
 }
 
 void SearchBar::join_threads() {
-	worker->die = true;
+	job_mutex.lock();
+	for (vector<SearchWorker *>::iterator it = workers.begin(); it != workers.end(); ++it) {
+		(*it)->die = true;
+	}
+	job_available.wakeAll();
+	page_searched.wakeAll();
+	job_mutex.unlock();
 	search_mutex.unlock();
-	worker->wait();
+	for (vector<SearchWorker *>::iterator it = workers.begin(); it != workers.end(); ++it) {
+		(*it)->wait();
+	}
 }
 
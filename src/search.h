@@ -4,6 +4,7 @@
 #include <QString>
 #include <QThread>
 #include <QMutex>
+#include <QWaitCondition>
 #include <QWidget>
 #include <QLineEdit>
 #include <QLabel>
@@ -11,23 +12,29 @@
 #include <QRect>
 #include <QEvent>
 #include <QList>
+#include <QSharedPointer>
 #if QT_VERSION >= 0x050000
 #	include <poppler-qt5.h>
 #else
 #	include <poppler-qt4.h>
 #endif
+#include <vector>
 
 
 class SearchBar;
+class SearchIndex;
+class DocumentPool;
 class Canvas;
 class Viewer;
 
 
+// worker 0 runs the searches and delivers the hits in order,
+// all workers search the pages it hands out
 class SearchWorker : public QThread {
 	Q_OBJECT
 
 public:
-	SearchWorker(SearchBar *_bar);
+	SearchWorker(SearchBar *_bar, int _id);
 	void run();
 
 	volatile bool stop;
@@ -39,7 +46,14 @@ signals:
 	void clear_hits();
 
 private:
+	void coordinate();
+	bool search_next_page();
+	bool index_next_page();
+	QList<QRectF> *search_page(int page, const QString &search_term, bool case_sensitive);
+	bool index_page(int page);
+
 	SearchBar *bar;
+	int id;
 	bool forward;
 };
 
@@ -48,10 +62,11 @@ class SearchBar : public QWidget {
 	Q_OBJECT
 
 public:
-	SearchBar(const QString &file, Viewer *v, QWidget *parent = 0);
+	SearchBar(Viewer *v, QWidget *parent = 0);
 	~SearchBar();
 
-	void load(const QString &file, const QByteArray &password);
+	// call after the resource manager loaded the document
+	void load();
 	bool is_valid() const;
 	void focus(bool forward = true);
 	const std::map<int,QList<QRectF> *> *get_hits() const;
@@ -73,7 +88,7 @@ private slots:
 	void set_text();
 
 private:
-	void initialize(const QString &file, const QByteArray &password);
+	void initialize();
 	void join_threads();
 	void shutdown();
 
@@ -81,19 +96,40 @@ private:
 	QLabel *progress;
 	QHBoxLayout *layout;
 
-	Poppler::Document *doc;
+	// the resource manager's, kept alive until the workers are done
+	QSharedPointer<DocumentPool> documents;
+	int page_count;
 	Viewer *viewer;
 
 	std::map<int,QList<QRectF> *> hits;
 
 	QMutex search_mutex;
 	QMutex term_mutex;
-	SearchWorker *worker;
+	std::vector<SearchWorker *> workers;
 	QString term;
 	int start_page;
 	bool forward_tmp;
 	bool forward;
 
+	// the running search, shared by all workers
+	QMutex job_mutex;
+	QWaitCondition job_available;
+	QWaitCondition page_searched;
+	int job_id;
+	bool job_active;
+	QString job_term;
+	bool job_case_sensitive;
+	int job_start;
+	bool job_forward;
+	int job_next; // pages are handed out in search order
+	std::vector<QList<QRectF> *> job_hits;
+	std::vector<bool> job_done;
+
+	// NULL when disabled
+	SearchIndex *index;
+	QString index_path;
+	int index_next; // next page to index in the background
+
 	friend class SearchWorker;
 };
 
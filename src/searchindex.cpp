@@ -0,0 +1,314 @@
+#include "searchindex.h"
+#include <QFile>
+#include <QDataStream>
+#include <QThread>
+#include <iostream>
+#include <set>
+
+using namespace std;
+
+
+static const quint32 index_magic = 0x6b696478; // "kidx"
+static const quint32 index_version = 1;
+
+
+// splits a search term at white space
+static QStringList tokenize(const QString &term, bool case_sensitive) {
+	QStringList tokens;
+	QString token;
+	for (QString::const_iterator it = term.begin(); it != term.end(); ++it) {
+		if (it->isSpace()) {
+			if (!token.isEmpty()) {
+				tokens.push_back(token);
+				token = QString();
+			}
+		} else {
+			token += *it;
+		}
+	}
+	if (!token.isEmpty()) {
+		tokens.push_back(token);
+	}
+	if (!case_sensitive) {
+		for (QStringList::iterator it = tokens.begin(); it != tokens.end(); ++it) {
+			*it = it->toLower();
+		}
+	}
+	return tokens;
+}
+
+
+SearchIndex::Page::Page() :
+		indexed(false) {
+}
+
+
+SearchIndex::SearchIndex(int page_count) :
+		pages(page_count),
+		indexed_count(0) {
+}
+
+bool SearchIndex::has_page(int page) const {
+	mutex.lock();
+	bool indexed = page >= 0 && page < (int) pages.size() && pages[page].indexed;
+	mutex.unlock();
+	return indexed;
+}
+
+bool SearchIndex::is_complete() const {
+	mutex.lock();
+	bool complete = indexed_count == (int) pages.size();
+	mutex.unlock();
+	return complete;
+}
+
+bool SearchIndex::add_page(int page, const QList<Poppler::TextBox *> &text) {
+	Page p;
+	Q_FOREACH(Poppler::TextBox *box, text) {
+		Word w;
+		w.text = box->text();
+		if (w.text.isEmpty()) {
+			continue;
+		}
+		w.folded = w.text.toLower();
+		w.bbox = box->boundingBox();
+		w.first_edge = p.edges.size();
+		for (int i = 0; i < w.text.length(); i++) {
+			p.edges.push_back(box->charBoundingBox(i).left());
+		}
+		p.edges.push_back(w.bbox.right());
+		p.words.push_back(w);
+	}
+
+	bool completed = false;
+	mutex.lock();
+	if (page >= 0 && page < (int) pages.size() && !pages[page].indexed) {
+		insert(page, p);
+		completed = indexed_count == (int) pages.size();
+	}
+	mutex.unlock();
+	return completed;
+}
+
+QList<QRectF> *SearchIndex::search_page(int page, const QString &term, bool case_sensitive) const {
+	QStringList tokens = tokenize(term, case_sensitive);
+	QList<QRectF> *hits = new QList<QRectF>;
+
+	mutex.lock();
+	if (!tokens.isEmpty() && page >= 0 && page < (int) pages.size()) {
+		const Page &p = pages[page];
+		for (int i = 0; i < (int) p.words.size(); i++) {
+			match(p, i, tokens, case_sensitive, hits);
+		}
+	}
+	mutex.unlock();
+	return hits;
+}
+
+map<int,QList<QRectF> *> SearchIndex::search(const QString &term, bool case_sensitive) const {
+	QStringList tokens = tokenize(term, case_sensitive);
+	map<int,QList<QRectF> *> hits;
+	if (tokens.isEmpty()) {
+		return hits;
+	}
+	// a single token can be anywhere inside a word,
+	// the first one of a phrase has to be at the end
+	QString first = tokens.first().toLower();
+
+	mutex.lock();
+	// sorted by page and reading order
+	set<pair<int, int> > candidates;
+	set<pair<QString, QString> >::const_iterator it = suffixes.lower_bound(make_pair(first, QString()));
+	for (; it != suffixes.end() && it->first.startsWith(first); ++it) {
+		if (tokens.size() > 1 && it->first.length() != first.length()) {
+			continue; // not at the end
+		}
+		const vector<pair<int, int> > &posting = postings.find(it->second)->second;
+		candidates.insert(posting.begin(), posting.end());
+	}
+
+	QList<QRectF> word_hits;
+	for (set<pair<int, int> >::const_iterator c = candidates.begin(); c != candidates.end(); ++c) {
+		match(pages[c->first], c->second, tokens, case_sensitive, &word_hits);
+		if (word_hits.isEmpty()) {
+			continue;
+		}
+		QList<QRectF> *&page_hits = hits[c->first];
+		if (page_hits == NULL) {
+			page_hits = new QList<QRectF>;
+		}
+		page_hits->append(word_hits);
+		word_hits.clear();
+	}
+	mutex.unlock();
+	return hits;
+}
+
+bool SearchIndex::load(const QString &path) {
+	QFile f(path);
+	if (!f.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+	QDataStream in(&f);
+	in.setVersion(QDataStream::Qt_4_6);
+	quint32 magic, version;
+	qint32 page_count;
+	in >> magic >> version >> page_count;
+	if (magic != index_magic || version != index_version || page_count != (qint32) pages.size()) {
+		return false;
+	}
+
+	map<int,Page> loaded;
+	while (in.status() == QDataStream::Ok) {
+		qint32 page, word_count, edge_count;
+		in >> page;
+		if (page < 0 || page >= page_count) {
+			break;
+		}
+		Page &p = loaded[page];
+		in >> word_count;
+		for (int i = 0; i < word_count && in.status() == QDataStream::Ok; i++) {
+			Word w;
+			qint32 first_edge;
+			in >> w.text >> w.bbox >> first_edge;
+			w.folded = w.text.toLower();
+			w.first_edge = first_edge;
+			p.words.push_back(w);
+		}
+		in >> edge_count;
+		for (int i = 0; i < edge_count && in.status() == QDataStream::Ok; i++) {
+			float edge;
+			in >> edge;
+			p.edges.push_back(edge);
+		}
+	}
+	if (in.status() != QDataStream::Ok) {
+		cerr << "failed to read search index " << path.toUtf8().constData() << endl;
+		return false;
+	}
+
+	mutex.lock();
+	for (map<int,Page>::iterator it = loaded.begin(); it != loaded.end(); ++it) {
+		if (!pages[it->first].indexed) {
+			insert(it->first, it->second);
+		}
+	}
+	mutex.unlock();
+	return true;
+}
+
+bool SearchIndex::save(const QString &path) const {
+	// write to a temporary file first, like the disk cache
+	QString tmp = path + QString::fromUtf8(".%1.tmp")
+		.arg(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+	QFile f(tmp);
+	if (!f.open(QIODevice::WriteOnly)) {
+		return false;
+	}
+	QDataStream out(&f);
+	out.setVersion(QDataStream::Qt_4_6);
+
+	mutex.lock();
+	out << index_magic << index_version << (qint32) pages.size();
+	for (int page = 0; page < (int) pages.size(); page++) {
+		const Page &p = pages[page];
+		if (!p.indexed) {
+			continue;
+		}
+		out << (qint32) page << (qint32) p.words.size();
+		for (vector<Word>::const_iterator w = p.words.begin(); w != p.words.end(); ++w) {
+			out << w->text << w->bbox << (qint32) w->first_edge;
+		}
+		out << (qint32) p.edges.size();
+		for (vector<float>::const_iterator e = p.edges.begin(); e != p.edges.end(); ++e) {
+			out << *e;
+		}
+	}
+	out << (qint32) -1;
+	mutex.unlock();
+
+	f.close();
+	if (out.status() != QDataStream::Ok) {
+		QFile::remove(tmp);
+		return false;
+	}
+	QFile::remove(path);
+	if (!QFile::rename(tmp, path)) {
+		QFile::remove(tmp);
+		return false;
+	}
+	return true;
+}
+
+// mutex must be locked
+void SearchIndex::insert(int page, Page &p) {
+	Page &dest = pages[page];
+	dest.words.swap(p.words);
+	dest.edges.swap(p.edges);
+	dest.indexed = true;
+	indexed_count++;
+	for (int i = 0; i < (int) dest.words.size(); i++) {
+		const QString &folded = dest.words[i].folded;
+		vector<pair<int, int> > &posting = postings[folded];
+		if (posting.empty()) { // new word
+			for (int j = 0; j < folded.length(); j++) {
+				suffixes.insert(make_pair(folded.mid(j), folded));
+			}
+		}
+		posting.push_back(make_pair(page, i));
+	}
+}
+
+// appends the hits starting in the given word
+void SearchIndex::match(const Page &p, int word, const QStringList &tokens, bool case_sensitive,
+		QList<QRectF> *hits) const {
+	const Word &w = p.words[word];
+	const QString &text = case_sensitive ? w.text : w.folded;
+	const QString &first = tokens.first();
+
+	if (tokens.size() == 1) {
+		int pos = text.indexOf(first);
+		while (pos != -1) {
+			hits->push_back(char_rect(p, w, pos, pos + first.length()));
+			pos = text.indexOf(first, pos + first.length());
+		}
+		return;
+	}
+
+	// phrase: end of this word, whole words in between, start of the last word
+	int count = tokens.size();
+	if (!text.endsWith(first) || word + count > (int) p.words.size()) {
+		return;
+	}
+	QRectF rect = char_rect(p, w, text.length() - first.length(), text.length());
+	for (int i = 1; i < count; i++) {
+		const Word &next = p.words[word + i];
+		const QString &next_text = case_sensitive ? next.text : next.folded;
+		if (i < count - 1) {
+			if (next_text != tokens[i]) {
+				return;
+			}
+			rect |= next.bbox;
+		} else {
+			if (!next_text.startsWith(tokens[i])) {
+				return;
+			}
+			rect |= char_rect(p, next, 0, tokens[i].length());
+		}
+	}
+	hits->push_back(rect);
+}
+
+QRectF SearchIndex::char_rect(const Page &p, const Word &w, int from, int to) const {
+	// lower casing can change the length in rare cases
+	int length = w.text.length();
+	from = qBound(0, from, length);
+	to = qBound(0, to, length);
+	float left = p.edges[w.first_edge + from];
+	float right = p.edges[w.first_edge + to];
+	if (right <= left) { // e.g. vertical text
+		return w.bbox;
+	}
+	return QRectF(left, w.bbox.top(), right - left, w.bbox.height());
+}
+
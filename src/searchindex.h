@@ -0,0 +1,73 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <QRectF>
+#include <QList>
+#include <QMutex>
+#if QT_VERSION >= 0x050000
+#	include <poppler-qt5.h>
+#else
+#	include <poppler-qt4.h>
+#endif
+#include <vector>
+#include <map>
+#include <set>
+
+
+// words of all pages with their positions, built once and then searched
+// without asking poppler again
+class SearchIndex {
+public:
+	SearchIndex(int page_count);
+
+	bool has_page(int page) const;
+	bool is_complete() const;
+	// returns true if this completed the index
+	bool add_page(int page, const QList<Poppler::TextBox *> &text);
+
+	// same matching rules as poppler's search: substrings, phrases across words
+	QList<QRectF> *search_page(int page, const QString &term, bool case_sensitive) const;
+	// searches all pages at once, only hits are returned
+	std::map<int,QList<QRectF> *> search(const QString &term, bool case_sensitive) const;
+
+	// adds the pages stored in the file that are still missing
+	bool load(const QString &path);
+	bool save(const QString &path) const;
+
+private:
+	class Word {
+	public:
+		QString text;
+		QString folded; // lower case
+		QRectF bbox;
+		int first_edge; // left edges of the characters, then the right edge
+	};
+
+	class Page {
+	public:
+		Page();
+
+		bool indexed;
+		std::vector<Word> words; // reading order
+		std::vector<float> edges;
+	};
+
+	void insert(int page, Page &p);
+	void match(const Page &p, int word, const QStringList &tokens, bool case_sensitive,
+			QList<QRectF> *hits) const;
+	QRectF char_rect(const Page &p, const Word &w, int from, int to) const;
+
+	std::vector<Page> pages;
+	int indexed_count;
+	// lower case word -> page, word
+	std::map<QString,std::vector<std::pair<int, int> > > postings;
+	// suffix, word; every suffix of every word in postings, so the words
+	// containing a term are found with a prefix lookup
+	std::set<std::pair<QString, QString> > suffixes;
+	mutable QMutex mutex;
+};
+
+#endif
+
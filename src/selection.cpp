@@ -3,103 +3,39 @@
 using namespace std;
 
 
-SelectionPart::SelectionPart(Poppler::TextBox *box) :
-		text_box(box) {
-	bbox = text_box->boundingBox();
-}
-
-SelectionPart::~SelectionPart() {
-	Poppler::TextBox *next;
-	do {
-		next = text_box->nextWord();
-		delete text_box;
-		text_box = next;
-	} while (next != NULL);
-}
-
-void SelectionPart::add_word(Poppler::TextBox *box) {
-	bbox = bbox.united(box->boundingBox());
-}
-
-Poppler::TextBox *SelectionPart::get_text() const {
-	return text_box;
-}
-
-QRectF SelectionPart::get_bbox() const {
-	return bbox;
-}
-
-bool selection_less_y(const SelectionPart *a, const SelectionPart *b) {
-	return a->get_bbox().center().y() < b->get_bbox().center().y();
-}
-
-
-SelectionLine::SelectionLine(SelectionPart *part) {
-	parts.push_back(part);
-	bbox = part->get_bbox();
-}
-
-SelectionLine::~SelectionLine() {
-	Q_FOREACH(SelectionPart *p, parts) {
-		delete p;
-	}
-}
-
-void SelectionLine::add_part(SelectionPart *part) {
-	parts.push_back(part);
-	bbox = bbox.united(part->get_bbox());
-}
-
-const QList<SelectionPart *> &SelectionLine::get_parts() const {
-	return parts;
-}
-
-QRectF SelectionLine::get_bbox() const {
-	return bbox;
-}
-
-void SelectionLine::sort() {
-	stable_sort(parts.begin(), parts.end(), selection_less_x);
-}
-
-bool selection_less_x(const SelectionPart *a, const SelectionPart *b) {
-	return a->get_bbox().center().x() < b->get_bbox().center().x();
-}
-
-
 void Cursor::find_part(bool from, enum Selection::Mode mode) {
-	const QList<SelectionPart *> parts = selectionline->get_parts();
+	const TextLayout::Line &l = layout->get_line(line);
 	// select beginning/end of line when gap between lines is big enough
-	if (selectionline->get_bbox().top() - click.y() > selectionline->get_bbox().height()) {
-		set_beginning_of_line(selectionline, from);
+	if (l.bbox.top() - click.y() > l.bbox.height()) {
+		set_beginning_of_line(layout, line, from);
 		return;
 	}
-	if (click.y() - selectionline->get_bbox().bottom() > selectionline->get_bbox().height()) {
-		set_end_of_line(selectionline, from);
+	if (click.y() - l.bbox.bottom() > l.bbox.height()) {
+		set_end_of_line(layout, line, from);
 		return;
 	}
 
 	if (mode == Selection::StartLine) {
 		if (from) {
-			set_beginning_of_line(selectionline, from);
+			set_beginning_of_line(layout, line, from);
 		} else {
-			set_end_of_line(selectionline, from);
+			set_end_of_line(layout, line, from);
 		}
 		return;
 	}
 
 	if (from) { // selection grows to the left
-		for (part = 0; part < parts.size(); part++) {
-			if (click.x() <= parts.at(part)->get_bbox().right()) {
+		for (part = 0; part < l.part_count; part++) {
+			if (click.x() <= layout->get_part(line, part).bbox.right()) {
 				break;
 			}
 		}
-		if (part >= parts.size()) {
-			part = parts.size() - 1;
+		if (part >= l.part_count) {
+			part = l.part_count - 1;
 		}
 	} else { // selection grows to the right
-		for (part = parts.size() - 1; part >= 0; part--) {
-			if (click.x() >= parts.at(part)->get_bbox().left()) {
+		for (part = l.part_count - 1; part >= 0; part--) {
+			if (click.x() >= layout->get_part(line, part).bbox.left()) {
 				break;
 			}
 		}
@@ -107,159 +43,138 @@ void Cursor::find_part(bool from, enum Selection::Mode mode) {
 			part = 0;
 		}
 	}
-	find_word(parts.at(part)->get_text(), from, mode);
+	find_word(from, mode);
 }
 
-void Cursor::find_word(const Poppler::TextBox *text_box, bool from, enum Selection::Mode mode) {
+void Cursor::find_word(bool from, enum Selection::Mode mode) {
+	int word_count = layout->get_part(line, part).word_count;
 	word = 0;
-	const Poppler::TextBox *next = text_box;
 	if (from) {
-		while (true) {
-			if (click.x() <= next->boundingBox().right()) {
-				break;
-			}
-
-			if (next->nextWord() == NULL) {
+		while (word + 1 < word_count) {
+			if (click.x() <= layout->get_word(line, part, word).bbox.right()) {
 				break;
 			}
-			next = next->nextWord();
 			word++;
 		}
 	} else {
-		const Poppler::TextBox *prev = next;
-		while (next != NULL) {
-			if (click.x() < next->boundingBox().left()) {
+		while (true) {
+			if (click.x() < layout->get_word(line, part, word).bbox.left()) {
 				if (word > 0) {
 					word--;
-					next = prev;
 				}
 				break;
 			}
 
-			if (next->nextWord() == NULL) {
+			if (word + 1 >= word_count) {
 				break;
 			}
-			prev = next;
-			next = next->nextWord();
 			word++;
 		}
 	}
+	const TextLayout::Word &w = layout->get_word(line, part, word);
 	if (mode == Selection::Start) {
-		find_character(next, from);
+		find_character(w, from);
 	} else if (mode == Selection::StartWord) {
 		if (from) {
 			character = 0;
 			inclusive = true;
-			x = next->charBoundingBox(0).left();
+			x = layout->char_left(w, 0);
 		} else {
-			character = next->text().size() - 1;
+			character = w.length - 1;
 			inclusive = true;
-			x = next->charBoundingBox(character).right();
+			x = layout->char_right(w, character);
 		}
 	}
 }
 
-void Cursor::find_character(const Poppler::TextBox *text, bool from) {
+void Cursor::find_character(const TextLayout::Word &w, bool from) {
 	if (from) { // selection grows to the left
-		for (character = 0; character < text->text().size(); character++) {
-			if (click.x() <= text->charBoundingBox(character).right()) {
-				x = text->charBoundingBox(character).left();
+		for (character = 0; character < w.length; character++) {
+			if (click.x() <= layout->char_right(w, character)) {
+				x = layout->char_left(w, character);
 				inclusive = true;
 				break;
 			}
 		}
-		if (character >= text->text().size()) {
-			character = text->text().size() - 1;
-			x = text->charBoundingBox(character).right();
+		if (character >= w.length) {
+			character = w.length - 1;
+			x = layout->char_right(w, character);
 			inclusive = false;
 		}
 	} else { // selection grows to the right
-		for (character = text->text().size() - 1; character >= 0; character--) {
-			if (click.x() >= text->charBoundingBox(character).left()) {
-				x = text->charBoundingBox(character).right();
+		for (character = w.length - 1; character >= 0; character--) {
+			if (click.x() >= layout->char_left(w, character)) {
+				x = layout->char_right(w, character);
 				inclusive = true;
 				break;
 			}
 		}
 		if (character < 0) {
 			character = 0;
-			x = text->charBoundingBox(character).left();
+			x = layout->char_left(w, character);
 			inclusive = false;
 		}
 	}
 }
 
-void Cursor::set_beginning_of_line(const SelectionLine *line, bool from) {
+void Cursor::set_beginning_of_line(const TextLayout *text, int l, bool from) {
 	part = 0;
 	word = 0;
 	character = 0;
 	inclusive = from;
-	x = line->get_parts().at(0)->get_text()->charBoundingBox(0).left();
+	x = text->char_left(text->get_word(l, 0, 0), 0);
 }
 
-void Cursor::set_end_of_line(const SelectionLine *line, bool from) {
-	part = line->get_parts().size() - 1;
-	Poppler::TextBox *text_box = line->get_parts().at(part)->get_text();
-	word = 0;
-	while (text_box->nextWord() != NULL) {
-		text_box = text_box->nextWord();
-		word++;
-	}
-	character = text_box->text().size() - 1;
+void Cursor::set_end_of_line(const TextLayout *text, int l, bool from) {
+	part = text->get_line(l).part_count - 1;
+	word = text->get_part(l, part).word_count - 1;
+	const TextLayout::Word &w = text->get_word(l, part, word);
+	character = w.length - 1;
 	inclusive = !from;
-	x = text_box->charBoundingBox(character).right();
+	x = text->char_right(w, character);
 }
 
 void Cursor::increment() {
-	Poppler::TextBox *text_box = selectionline->get_parts().at(part)->get_text();
-	for (int i = 0; i < word; i++) {
-		text_box = text_box->nextWord();
-	}
+	const TextLayout::Word &w = layout->get_word(line, part, word);
 
 	if (!inclusive) {
 		inclusive = true;
-		x = text_box->charBoundingBox(character).left();
+		x = layout->char_left(w, character);
 		return;
 	}
 
 	character++;
-	if (character >= text_box->text().size()) {
-		if (text_box->nextWord() == NULL) {
+	if (character >= w.length) {
+		if (word + 1 >= layout->get_part(line, part).word_count) {
 			part++;
-			if (part >= selectionline->get_parts().size()) {
+			if (part >= layout->get_line(line).part_count) {
 				part--;
 				character--;
 				inclusive = false;
-				x = text_box->charBoundingBox(character).right();
+				x = layout->char_right(w, character);
 				return;
 			}
 			word = 0;
 			character = 0;
 			inclusive = true;
-			x = selectionline->get_parts().at(part)->get_text()->charBoundingBox(0).left();
+			x = layout->char_left(layout->get_word(line, part, 0), 0);
 			return;
 		}
-		text_box = text_box->nextWord();
 		word++;
 		character = 0;
 		inclusive = true;
-		x = text_box->charBoundingBox(0).left();
+		x = layout->char_left(layout->get_word(line, part, word), 0);
 		return;
 	}
-	x = text_box->charBoundingBox(character).left();
+	x = layout->char_left(w, character);
 }
 
 void Cursor::decrement() {
-	Poppler::TextBox *text_box = selectionline->get_parts().at(part)->get_text();
-	Poppler::TextBox *prev = text_box;
-	for (int i = 0; i < word; i++) {
-		prev = text_box;
-		text_box = text_box->nextWord();
-	}
+	const TextLayout::Word &w = layout->get_word(line, part, word);
 
 	if (!inclusive) {
 		inclusive = true;
-		x = text_box->charBoundingBox(character).right();
+		x = layout->char_right(w, character);
 		return;
 	}
 
@@ -269,28 +184,25 @@ void Cursor::decrement() {
 			if (part == 0) {
 				character = 0;
 				inclusive = false;
-				x = text_box->charBoundingBox(0).left();
+				x = layout->char_left(w, 0);
 				return;
 			}
 			part--;
-			text_box = selectionline->get_parts().at(part)->get_text();
-			word = 0;
-			while (text_box->nextWord() != NULL) {
-				text_box = text_box->nextWord();
-				word++;
-			}
-			character = text_box->text().size() - 1;
+			word = layout->get_part(line, part).word_count - 1;
+			const TextLayout::Word &last = layout->get_word(line, part, word);
+			character = last.length - 1;
 			inclusive = true;
-			x = text_box->charBoundingBox(character).right();
+			x = layout->char_right(last, character);
 			return;
 		}
 		word--;
-		character = prev->text().size() - 1;
+		const TextLayout::Word &prev = layout->get_word(line, part, word);
+		character = prev.length - 1;
 		inclusive = true;
-		x = prev->charBoundingBox(character).right();
+		x = layout->char_right(prev, character);
 		return;
 	}
-	x = text_box->charBoundingBox(character).right();
+	x = layout->char_right(w, character);
 }
 
 
@@ -298,7 +210,7 @@ MouseSelection::MouseSelection() :
 		active(false) {
 }
 
-void MouseSelection::set_cursor(const QList<SelectionLine *> *lines,
+void MouseSelection::set_cursor(const TextLayout *text,
 		pair<int, QPointF> pos, enum Selection::Mode _mode) {
 	// first = true: first cursor that was created (beginning of selection)
 	// from = true: cursor that comes first (from the top left)
@@ -318,15 +230,15 @@ void MouseSelection::set_cursor(const QList<SelectionLine *> *lines,
 	c.page = pos.first;
 	c.click = pos.second;
 
-	if (lines == NULL || lines->empty()) {
+	if (text == NULL || text->line_count() == 0) {
 		return;
 	}
 
-	c.line = bsearch(lines, c.click.y());
-	if (c.line < lines->size() - 1) {
+	c.line = bsearch(text, c.click.y());
+	if (c.line < text->line_count() - 1) {
 		// the click lies between line and line + 1
-		float prev = lines->at(c.line)->get_bbox().center().y();
-		float next = lines->at(c.line + 1)->get_bbox().center().y();
+		float prev = text->get_line(c.line).bbox.center().y();
+		float next = text->get_line(c.line + 1).bbox.center().y();
 
 		if (first) {
 			// beginning of selection -> set to closest line
@@ -341,39 +253,39 @@ void MouseSelection::set_cursor(const QList<SelectionLine *> *lines,
 			bool line_added = false;
 			if (c.click.y() - prev > next - c.click.y()) {
 				if (c.line + 1 == cursor[0].line ||
-						lines->at(c.line)->get_bbox().bottom() > lines->at(c.line + 1)->get_bbox().top()) {
+						text->get_line(c.line).bbox.bottom() > text->get_line(c.line + 1).bbox.top()) {
 					c.line++;
 					line_added = true;
 				}
 			}
-			update_reversed(c, lines->at(c.line));
+			update_reversed(c, text->get_line(c.line).bbox);
 
 			// inside actual box?
 			if (!line_added) {
-				if (lines->at(c.line)->get_bbox().bottom() <= lines->at(c.line + 1)->get_bbox().top()) {
+				if (text->get_line(c.line).bbox.bottom() <= text->get_line(c.line + 1).bbox.top()) {
 					if (reversed && c.line < cursor[0].line) {
-						if (c.click.y() > lines->at(c.line)->get_bbox().bottom()) {
+						if (c.click.y() > text->get_line(c.line).bbox.bottom()) {
 							c.line++;
 						}
 					} else {
-						if (c.click.y() >= lines->at(c.line + 1)->get_bbox().top()) {
+						if (c.click.y() >= text->get_line(c.line + 1).bbox.top()) {
 							c.line++;
 						}
 					}
 				}
 			}
 
-			update_reversed(c, lines->at(c.line));
+			update_reversed(c, text->get_line(c.line).bbox);
 		}
 	} else {
 		// last line
 		if (!first) {
-			update_reversed(c, lines->at(c.line));
+			update_reversed(c, text->get_line(c.line).bbox);
 		}
 	}
 
 	// find closest part/word/character
-	c.selectionline = lines->at(c.line);
+	c.layout = text;
 	c.find_part(first ^ reversed, mode);
 
 	// word or line selection -> set second cursor right away
@@ -392,19 +304,19 @@ Cursor MouseSelection::get_cursor(bool from) const {
 	}
 }
 
-QString MouseSelection::get_selection_text(int page, const QList<SelectionLine *> *lines) const {
+QString MouseSelection::get_selection_text(int page, const TextLayout *layout) const {
 	QString text;
-	if (lines != NULL && lines->size() != 0 && is_active()) {
+	if (layout != NULL && layout->line_count() != 0 && is_active()) {
 		Cursor from = get_cursor(true);
 		Cursor to = get_cursor(false);
 		if (from.page <= page && to.page >= page) {
 			if (from.page < page) {
 				from.line = 0;
-				from.set_beginning_of_line(lines->at(from.line), true);
+				from.set_beginning_of_line(layout, from.line, true);
 			}
 			if (to.page > page) {
-				to.line = lines->size() - 1;
-				to.set_end_of_line(lines->at(to.line), false);
+				to.line = layout->line_count() - 1;
+				to.set_end_of_line(layout, to.line, false);
 			}
 
 			bool add_space = false;
@@ -412,21 +324,21 @@ QString MouseSelection::get_selection_text(int page, const QList<SelectionLine *
 			for (int line = from.line; line <= to.line; line++) {
 				float last_x = 0;
 				int last_x_index = -2;
-				const QList<SelectionPart *> p = lines->at(line)->get_parts();
+				int part_count = layout->get_line(line).part_count;
 
-				for (int part = from.part; part < p.size(); part++) {
+				for (int part = from.part; part < part_count; part++) {
 					if (to.line == line && to.part < part) {
 						break;
 					}
-					int word = 0;
-					Poppler::TextBox *box = p.at(part)->get_text();
-					while (box != NULL) {
+					int word_count = layout->get_part(line, part).word_count;
+					for (int word = 0; word < word_count; word++) {
 						if (to.line == line && to.part == part && to.word < word) {
 							break;
 						}
+						const TextLayout::Word &w = layout->get_word(line, part, word);
 
 						if ((from.part == part && word >= from.word) || part > from.part) {
-							QString tmp = box->text();
+							QString tmp = layout->get_text(w);
 							if (to.line == line && to.part == part && to.word == word) {
 								tmp.truncate(to.character + 1);
 								if (!to.inclusive) {
@@ -446,26 +358,24 @@ QString MouseSelection::get_selection_text(int page, const QList<SelectionLine *
 							}
 							// big gap in front of current box, add <tab>
 							if (word == 0 && part == last_x_index + 1) {
-								if (box->boundingBox().left() - last_x > box->boundingBox().height()) {
+								if (w.bbox.left() - last_x > w.bbox.height()) {
 									text += QChar::fromLatin1('\t');
 								}
 							}
 
 							text += tmp;
-							if (box->hasSpaceAfter()) {
+							if (w.space_after) {
 								add_space = true;
 							}
 						}
 
-						last_x = box->boundingBox().right();
+						last_x = w.bbox.right();
 						last_x_index = part;
-						box = box->nextWord();
-						word++;
 					}
 				}
 
-				if (line + 1 < lines->size()) {
-					from.set_beginning_of_line(lines->at(line + 1), true);
+				if (line + 1 < layout->line_count()) {
+					from.set_beginning_of_line(layout, line + 1, true);
 					if (line < to.line) {
 						text += QChar::fromLatin1('\n');
 					}
@@ -484,23 +394,23 @@ bool MouseSelection::is_active() const {
 	return active;
 }
 
-int MouseSelection::bsearch(const QList<SelectionLine *> *lines, float value) {
-	int from = 0, to = lines->size();
+int MouseSelection::bsearch(const TextLayout *text, float value) {
+	int from = 0, to = text->line_count();
 	int mid;
 
 	if (to == 0) {
 		return 0;
 	}
 
-	if (value <= lines->at(0)->get_bbox().center().y()) {
+	if (value <= text->get_line(0).bbox.center().y()) {
 		return 0;
-	} else if (value > lines->at(to - 1)->get_bbox().center().y()) {
+	} else if (value > text->get_line(to - 1).bbox.center().y()) {
 		return to - 1;
 	}
 
 	while (to - from > 1) {
 		mid = (from + to) / 2;
-		float cur = lines->at(mid)->get_bbox().center().y();
+		float cur = text->get_line(mid).bbox.center().y();
 		if (cur == value) {
 			return mid;
 		} else if (cur < value) {
@@ -513,7 +423,7 @@ int MouseSelection::bsearch(const QList<SelectionLine *> *lines, float value) {
 	return from;
 }
 
-void MouseSelection::update_reversed(Cursor &c, const SelectionLine *line) {
+void MouseSelection::update_reversed(Cursor &c, const QRectF &line) {
 	if (reversed != calculate_reversed(c, line)) {
 		// flip reversed flag, adjust first cursor's character
 		if (reversed) {
@@ -525,7 +435,7 @@ void MouseSelection::update_reversed(Cursor &c, const SelectionLine *line) {
 	}
 }
 
-bool MouseSelection::calculate_reversed(Cursor &c, const SelectionLine *line) const {
+bool MouseSelection::calculate_reversed(Cursor &c, const QRectF &line) const {
 	if (c.page < cursor[0].page) {
 		return true;
 	} else if (c.page > cursor[0].page) {
@@ -538,10 +448,10 @@ bool MouseSelection::calculate_reversed(Cursor &c, const SelectionLine *line) co
 		return false;
 	}
 	// same line
-	if (line->get_bbox().top() - c.click.y() > line->get_bbox().height()) {
+	if (line.top() - c.click.y() > line.height()) {
 		return true;
 	}
-	if (c.click.y() - line->get_bbox().bottom() > line->get_bbox().height()) {
+	if (c.click.y() - line.bottom() > line.height()) {
 		return false;
 	}
 	if (c.click.x() < cursor[0].x) {
@@ -2,11 +2,10 @@
 #define SELECTIONPART_H
 
 #include <QRectF>
-#if QT_VERSION >= 0x050000
-#	include <poppler-qt5.h>
-#else
-#	include <poppler-qt4.h>
-#endif
+#include <QPointF>
+#include <QString>
+#include <utility>
+#include "textlayout.h"
 
 
 namespace Selection {
@@ -19,42 +18,6 @@ namespace Selection {
 }
 
 
-class SelectionPart {
-public:
-	SelectionPart(Poppler::TextBox *box);
-	~SelectionPart();
-
-	void add_word(Poppler::TextBox *box);
-	Poppler::TextBox *get_text() const;
-	QRectF get_bbox() const;
-
-private:
-	Poppler::TextBox *text_box;
-	QRectF bbox;
-};
-
-bool selection_less_y(const SelectionPart *a, const SelectionPart *b);
-
-
-class SelectionLine {
-public:
-	SelectionLine(SelectionPart *part);
-	~SelectionLine();
-
-	void add_part(SelectionPart *part);
-	const QList<SelectionPart *> &get_parts() const;
-	QRectF get_bbox() const;
-
-	void sort();
-
-private:
-	QList<SelectionPart *> parts;
-	QRectF bbox;
-};
-
-bool selection_less_x(const SelectionPart *a, const SelectionPart *b);
-
-
 class Cursor {
 public:
 	int page;
@@ -65,15 +28,16 @@ public:
 	int character;
 	bool inclusive;
 	float x;
-	SelectionLine *selectionline;
+	const TextLayout *layout; // of page
 
 private:
 	void find_part(bool from, enum Selection::Mode mode);
-	void find_word(const Poppler::TextBox *text_box, bool from, enum Selection::Mode mode);
-	void find_character(const Poppler::TextBox *text, bool from);
+	void find_word(bool from, enum Selection::Mode mode);
+	void find_character(const TextLayout::Word &w, bool from);
 
-	void set_beginning_of_line(const SelectionLine *line, bool from);
-	void set_end_of_line(const SelectionLine *line, bool from);
+	// only sets part, word, character and x
+	void set_beginning_of_line(const TextLayout *text, int l, bool from);
+	void set_end_of_line(const TextLayout *text, int l, bool from);
 
 	void increment();
 	void decrement();
@@ -86,17 +50,17 @@ class MouseSelection {
 public:
 	MouseSelection();
 
-	void set_cursor(const QList<SelectionLine *> *lines, std::pair<int, QPointF> pos, enum Selection::Mode mode);
+	void set_cursor(const TextLayout *text, std::pair<int, QPointF> pos, enum Selection::Mode mode);
 	Cursor get_cursor(bool from) const;
-	QString get_selection_text(int page, const QList<SelectionLine *> *lines) const;
+	QString get_selection_text(int page, const TextLayout *text) const;
 
 	void deactivate();
 	bool is_active() const;
 
 private:
-	int bsearch(const QList<SelectionLine *> *lines, float value);
-	void update_reversed(Cursor &c, const SelectionLine *line) ;
-	bool calculate_reversed(Cursor &c, const SelectionLine *line) const;
+	int bsearch(const TextLayout *text, float value);
+	void update_reversed(Cursor &c, const QRectF &line);
+	bool calculate_reversed(Cursor &c, const QRectF &line) const;
 
 	Cursor cursor[2];
 
@@ -0,0 +1,160 @@
+#include "textlayout.h"
+#include <set>
+#include <algorithm>
+
+using namespace std;
+
+
+// a chain of boxes, before it is sorted into a line
+class Chain {
+public:
+	QRectF bbox;
+	int first_box;
+	int box_count;
+};
+
+static bool chain_less_y(const Chain &a, const Chain &b) {
+	return a.bbox.center().y() < b.bbox.center().y();
+}
+
+static bool chain_less_x(const Chain &a, const Chain &b) {
+	return a.bbox.center().x() < b.bbox.center().x();
+}
+
+TextLayout::TextLayout(const QList<Poppler::TextBox *> &boxes) {
+	// make single parts from chained boxes
+	set<Poppler::TextBox *> used;
+	vector<Poppler::TextBox *> chained;
+	vector<Chain> chains;
+	chained.reserve(boxes.size());
+	Q_FOREACH(Poppler::TextBox *box, boxes) {
+		if (used.find(box) != used.end()) {
+			continue;
+		}
+		Chain c;
+		c.bbox = box->boundingBox();
+		c.first_box = chained.size();
+		for (Poppler::TextBox *next = box; next != NULL; next = next->nextWord()) {
+			used.insert(next);
+			chained.push_back(next);
+			c.bbox = c.bbox.united(next->boundingBox());
+		}
+		c.box_count = chained.size() - c.first_box;
+		chains.push_back(c);
+	}
+
+	// sort by y coordinate
+	stable_sort(chains.begin(), chains.end(), chain_less_y);
+
+	// assign parts to lines, a part that overlaps the center of the line's
+	// first part joins it unless both of its dimensions differ a lot
+	vector<pair<int, int> > line_ranges; // into chains
+	QRectF line_box;
+	for (unsigned int i = 0; i < chains.size(); i++) {
+		QRectF box = chains[i].bbox;
+		if (!line_ranges.empty() && box.y() <= line_box.center().y() && box.bottom() > line_box.center().y()) {
+			float ratio_w = box.width() / line_box.width();
+			float ratio_h = box.height() / line_box.height();
+			if (ratio_w < 1.0f) {
+				ratio_w = 1.0f / ratio_w;
+			}
+			if (ratio_h < 1.0f) {
+				ratio_h = 1.0f / ratio_h;
+			}
+			if (ratio_w <= 1.3f || ratio_h <= 1.3f) {
+				line_ranges.back().second++;
+				continue;
+			}
+		}
+		// it doesn't fit, create new line
+		line_ranges.push_back(make_pair(i, i + 1));
+		line_box = box;
+	}
+
+	// copy everything into the flat arrays
+	int char_count = 0;
+	for (unsigned int i = 0; i < chained.size(); i++) {
+		char_count += chained[i]->text().size();
+	}
+	lines.reserve(line_ranges.size());
+	parts.reserve(chains.size());
+	words.reserve(chained.size());
+	edges.reserve(char_count);
+	text.reserve(char_count);
+
+	for (unsigned int l = 0; l < line_ranges.size(); l++) {
+		vector<Chain>::iterator begin = chains.begin() + line_ranges[l].first;
+		vector<Chain>::iterator end = chains.begin() + line_ranges[l].second;
+		stable_sort(begin, end, chain_less_x);
+
+		Line line;
+		line.bbox = begin->bbox;
+		line.first_part = parts.size();
+		line.part_count = end - begin;
+		for (vector<Chain>::iterator c = begin; c != end; ++c) {
+			line.bbox = line.bbox.united(c->bbox);
+
+			Part part;
+			part.bbox = c->bbox;
+			part.first_word = words.size();
+			part.word_count = c->box_count;
+			for (int b = c->first_box; b < c->first_box + c->box_count; b++) {
+				Poppler::TextBox *box = chained[b];
+				QString box_text = box->text();
+
+				Word word;
+				word.bbox = box->boundingBox();
+				word.first_char = text.size();
+				word.length = box_text.size();
+				word.space_after = box->hasSpaceAfter();
+				words.push_back(word);
+
+				text += box_text;
+				for (int i = 0; i < box_text.size(); i++) {
+					QRectF r = box->charBoundingBox(i);
+					Edge e;
+					e.left = r.left();
+					e.right = r.right();
+					edges.push_back(e);
+				}
+			}
+			parts.push_back(part);
+		}
+		lines.push_back(line);
+	}
+}
+
+int TextLayout::line_count() const {
+	return lines.size();
+}
+
+const TextLayout::Line &TextLayout::get_line(int line) const {
+	return lines[line];
+}
+
+const TextLayout::Part &TextLayout::get_part(int line, int part) const {
+	return parts[lines[line].first_part + part];
+}
+
+const TextLayout::Word &TextLayout::get_word(int line, int part, int word) const {
+	return words[get_part(line, part).first_word + word];
+}
+
+QString TextLayout::get_text(const Word &w) const {
+	return text.mid(w.first_char, w.length);
+}
+
+float TextLayout::char_left(const Word &w, int c) const {
+	if (c < 0 || c >= w.length) {
+		return w.bbox.left();
+	}
+	return edges[w.first_char + c].left;
+}
+
+float TextLayout::char_right(const Word &w, int c) const {
+	if (c < 0 || c >= w.length) {
+		return w.bbox.right();
+	}
+	return edges[w.first_char + c].right;
+}
+
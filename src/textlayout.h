@@ -0,0 +1,69 @@
+#ifndef TEXTLAYOUT_H
+#define TEXTLAYOUT_H
+
+#include <QString>
+#include <QRectF>
+#include <QList>
+#if QT_VERSION >= 0x050000
+#	include <poppler-qt5.h>
+#else
+#	include <poppler-qt4.h>
+#endif
+#include <vector>
+
+
+// the text of a page in a few flat arrays instead of a heap object per word
+// lines consist of parts (words poppler chained together), parts of words,
+// words of characters; lines are sorted by y, parts within a line by x
+class TextLayout {
+public:
+	class Line {
+	public:
+		QRectF bbox;
+		int first_part;
+		int part_count;
+	};
+
+	class Part {
+	public:
+		QRectF bbox;
+		int first_word;
+		int word_count;
+	};
+
+	class Word {
+	public:
+		QRectF bbox;
+		int first_char; // into the text and the character edges
+		int length;
+		bool space_after;
+	};
+
+	// the boxes are still owned by the caller afterwards
+	TextLayout(const QList<Poppler::TextBox *> &boxes);
+
+	int line_count() const;
+	const Line &get_line(int line) const;
+	const Part &get_part(int line, int part) const;
+	const Word &get_word(int line, int part, int word) const;
+	QString get_text(const Word &w) const;
+	// horizontal extent of a character
+	float char_left(const Word &w, int c) const;
+	float char_right(const Word &w, int c) const;
+
+private:
+	class Edge {
+	public:
+		float left;
+		float right;
+	};
+
+	std::vector<Line> lines;
+	std::vector<Part> parts;
+	std::vector<Word> words;
+	std::vector<Edge> edges;
+	QString text;
+};
+
+#endif
+
@@ -0,0 +1,136 @@
+#include "textworker.h"
+#include "resourcemanager.h"
+#include "kpage.h"
+#include "textlayout.h"
+#include "profiler.h"
+#include "documentpool.h"
+#include <iostream>
+#if QT_VERSION >= 0x050000
+#	include <poppler-qt5.h>
+#else
+#	include <poppler-qt4.h>
+#endif
+
+using namespace std;
+
+
+// how often to check whether the render workers became idle
+static const unsigned long idle_poll = 100; // ms
+// pages that were rendered long ago are probably out of view
+static const unsigned int background_limit = 64;
+
+
+TextWorker::TextWorker(ResourceManager *res) :
+		res(res),
+		die(false) {
+}
+
+void TextWorker::run() {
+	mutex.lock();
+	while (!die) {
+		int page;
+		if (!background.empty() && res->scheduler.is_idle()) {
+			page = background.front();
+			background.pop_front();
+		} else {
+			if (background.empty()) {
+				work_available.wait(&mutex);
+			} else { // the render workers are busy
+				work_available.wait(&mutex, idle_poll);
+			}
+			continue;
+		}
+		mutex.unlock();
+
+		extract(page);
+
+		mutex.lock();
+	}
+	mutex.unlock();
+}
+
+void TextWorker::prefetch(int page) {
+	mutex.lock();
+	background.remove(page);
+	background.push_front(page);
+	if (background.size() > background_limit) {
+		background.pop_back();
+	}
+	work_available.wakeOne();
+	mutex.unlock();
+}
+
+void TextWorker::stop() {
+	mutex.lock();
+	die = true;
+	work_available.wakeAll();
+	mutex.unlock();
+}
+
+void TextWorker::extract(int page, Poppler::Document *doc) {
+	KPage &kp = res->k_page[page];
+
+	res->link_mutex.lock();
+	bool need_links = kp.links == NULL;
+	bool need_text = kp.text == NULL;
+	res->link_mutex.unlock();
+	if (!need_links && !need_text) {
+		return;
+	}
+
+#ifdef DEBUG
+	cerr << "    extracting text of page " << page << endl;
+#endif
+	qint64 start = Profiler::get_instance()->begin();
+	// a broken page gets empty lists, so nobody waits for it forever
+	QList<Poppler::Link *> *links = new QList<Poppler::Link *>;
+	TextLayout *text = NULL;
+	bool borrowed = doc == NULL;
+	if (borrowed) {
+		doc = res->documents->acquire();
+	}
+	Poppler::Page *p = doc != NULL ? doc->page(page) : NULL;
+	if (p == NULL) {
+		cerr << "failed to load page " << page << endl;
+		text = new TextLayout(QList<Poppler::TextBox *>());
+	} else {
+		// collect goto links
+		if (need_links) {
+			QList<Poppler::Link *> l = p->links();
+			links->swap(l);
+		}
+		QList<Poppler::TextBox *> boxes;
+		if (need_text) {
+			boxes = p->textList();
+		}
+		text = new TextLayout(boxes);
+		qDeleteAll(boxes);
+		delete p;
+	}
+	if (borrowed && doc != NULL) {
+		res->documents->release(doc);
+	}
+
+	res->link_mutex.lock();
+	if (kp.links == NULL) {
+		kp.links = links;
+		links = NULL;
+	}
+	if (kp.text == NULL) {
+		kp.text = text;
+		text = NULL;
+	}
+	res->link_mutex.unlock();
+
+	if (links != NULL) {
+		Q_FOREACH(Poppler::Link *l, *links) {
+			delete l;
+		}
+		delete links;
+	}
+	delete text;
+	Profiler::get_instance()->end(Profile::Text, start);
+
+	emit text_ready(page);
+}
+
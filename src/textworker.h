@@ -0,0 +1,46 @@
+#ifndef TEXTWORKER_H
+#define TEXTWORKER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <list>
+
+
+class ResourceManager;
+namespace Poppler {
+	class Document;
+}
+
+
+// extracts the links and the text layout of pages, so the render workers
+// don't have to; pages are done while nothing is rendering
+class TextWorker : public QThread {
+	Q_OBJECT
+
+public:
+	TextWorker(ResourceManager *res);
+	void run();
+
+	// extract the page once the render workers are idle
+	void prefetch(int page);
+	void stop();
+	// extracts the page right away on the calling thread with doc, which
+	// must not be used by another thread; NULL borrows one from the pool
+	void extract(int page, Poppler::Document *doc = NULL);
+
+signals:
+	void text_ready(int page);
+
+private:
+	ResourceManager *res;
+
+	QMutex mutex;
+	QWaitCondition work_available;
+	// newest first
+	std::list<int> background;
+	bool die;
+};
+
+#endif
+
@@ -0,0 +1,169 @@
+#include "thumbnails.h"
+#include "resourcemanager.h"
+#include "profiler.h"
+#include "documentpool.h"
+#include "util.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#if QT_VERSION >= 0x050000
+#	include <poppler-qt5.h>
+#else
+#	include <poppler-qt4.h>
+#endif
+
+using namespace std;
+
+
+// sheets are at most this wide and high
+static const int sheet_size = 1024;
+// how long to step back while visible pages are waiting to be rendered
+static const unsigned long idle_poll = 100; // ms
+
+
+//==[ ThumbnailAtlas ]=========================================================
+ThumbnailAtlas::ThumbnailAtlas(int page_count, int size) :
+		size(size),
+		bytes(0),
+		present(page_count, false) {
+	columns = max(1, sheet_size / size);
+	cells = columns * columns;
+	// sheets are allocated when their first thumbnail arrives
+	int sheet_count = (page_count + cells - 1) / cells;
+	sheets.resize(sheet_count);
+	inverted_sheets.resize(sheet_count);
+	for (int i = 0; i < page_count; i++) {
+		missing.insert(i);
+	}
+}
+
+int ThumbnailAtlas::get_size() const {
+	return size;
+}
+
+int ThumbnailAtlas::get_bytes() {
+	mutex.lock();
+	int b = bytes;
+	mutex.unlock();
+	return b;
+}
+
+bool ThumbnailAtlas::has(int page) {
+	mutex.lock();
+	bool p = present[page];
+	mutex.unlock();
+	return p;
+}
+
+bool ThumbnailAtlas::insert(int page, const QImage &img, QImage *thumbnail, QImage *inverted) {
+	QImage normal = img.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	QImage other = normal.copy();
+	invert_image(&other);
+
+	mutex.lock();
+	if (present[page]) {
+		mutex.unlock();
+		return false;
+	}
+	*thumbnail = cell(sheets, page, normal);
+	*inverted = cell(inverted_sheets, page, other);
+	present[page] = true;
+	missing.erase(page);
+	mutex.unlock();
+	return true;
+}
+
+int ThumbnailAtlas::take(int center) {
+	mutex.lock();
+	if (missing.empty()) {
+		mutex.unlock();
+		return -1;
+	}
+	// go down first
+	set<int>::iterator greater = missing.lower_bound(center);
+	set<int>::iterator it = greater;
+	if (greater == missing.end()) {
+		--it;
+	} else if (greater != missing.begin()) {
+		set<int>::iterator less = greater;
+		--less;
+		if (*greater - center > center - *less) {
+			it = less;
+		}
+	}
+	int page = *it;
+	missing.erase(it);
+	mutex.unlock();
+	return page;
+}
+
+// mutex must be locked
+QImage ThumbnailAtlas::cell(vector<QImage> &s, int page, const QImage &img) {
+	QImage &sheet = s[page / cells];
+	if (sheet.isNull()) {
+		int rows = min(columns, (int) (present.size() - page / cells * cells + columns - 1) / columns);
+		sheet = QImage(columns * size, rows * size, QImage::Format_ARGB32_Premultiplied);
+		sheet.fill(0);
+		bytes += sheet.bytesPerLine() * sheet.height();
+	}
+	int x = page % cells % columns * size;
+	int y = page % cells / columns * size;
+	// the sheets are never copied, bits() does not detach
+	uchar *bits = sheet.bits() + y * sheet.bytesPerLine() + x * 4;
+	for (int row = 0; row < size; row++) {
+		memcpy(bits + row * sheet.bytesPerLine(), img.constScanLine(row), size * 4);
+	}
+	// a read-only view sharing the sheet's memory
+	const uchar *view = bits;
+	return QImage(view, size, size, sheet.bytesPerLine(), QImage::Format_ARGB32_Premultiplied);
+}
+
+
+//==[ ThumbnailWorker ]========================================================
+ThumbnailWorker::ThumbnailWorker(ResourceManager *res) :
+		die(false),
+		res(res) {
+}
+
+void ThumbnailWorker::run() {
+	int size = res->thumbnails->get_size();
+	while (!die) {
+		// the visible pages come first
+		if (res->scheduler.is_waiting(Render::Visible)) {
+			msleep(idle_poll);
+			continue;
+		}
+		int page = res->thumbnails->take(res->scheduler.get_center());
+		if (page == -1) {
+			break;
+		}
+
+		Poppler::Document *doc = res->documents->acquire();
+		if (doc == NULL) {
+			cerr << "failed to open document for thumbnail thread" << endl;
+			break;
+		}
+		Poppler::Page *p = doc->page(page);
+		if (p == NULL) {
+			cerr << "failed to load page " << page << endl;
+			res->documents->release(doc);
+			continue;
+		}
+		// twice the thumbnail's resolution for the downscaling filter
+		float dpi = 72.0 * 2 * size / p->pageSizeF().width();
+		qint64 start = Profiler::get_instance()->begin();
+		QImage img = p->renderToImage(dpi, dpi);
+		Profiler::get_instance()->end(Profile::Thumbnail, start);
+		delete p;
+		res->documents->release(doc);
+		if (img.isNull()) {
+			cerr << "failed to render thumbnail of page " << page << endl;
+			continue;
+		}
+
+		if (res->set_thumbnail(page, img, 0)) {
+			emit page_rendered(page);
+		}
+	}
+}
+
@@ -0,0 +1,63 @@
+#ifndef THUMBNAILS_H
+#define THUMBNAILS_H
+
+#include <QThread>
+#include <QImage>
+#include <QMutex>
+#include <vector>
+#include <set>
+
+
+class ResourceManager;
+
+
+// the thumbnails of all pages, packed into a few big images instead of one
+// small image per page; the thumbnails handed out are views into them
+class ThumbnailAtlas {
+public:
+	ThumbnailAtlas(int page_count, int size);
+
+	int get_size() const;
+	// memory of the allocated sheets
+	int get_bytes();
+	bool has(int page);
+	// copies img (unrotated, size x size) into the page's cell and returns views
+	// of it and its inverted version, false if the page was already there
+	bool insert(int page, const QImage &img, QImage *thumbnail, QImage *inverted);
+	// the missing page closest to center, -1 if all pages are done
+	int take(int center);
+
+private:
+	QImage cell(std::vector<QImage> &sheets, int page, const QImage &img);
+
+	int size;
+	int columns; // cells per sheet row
+	int cells; // per sheet
+	int bytes;
+	std::vector<QImage> sheets;
+	std::vector<QImage> inverted_sheets;
+	std::set<int> missing;
+	std::vector<bool> present;
+	QMutex mutex;
+};
+
+
+// renders thumbnails of all pages in the background
+class ThumbnailWorker : public QThread {
+	Q_OBJECT
+
+public:
+	ThumbnailWorker(ResourceManager *res);
+	void run();
+
+	volatile bool die;
+
+signals:
+	void page_rendered(int page);
+
+private:
+	ResourceManager *res;
+};
+
+#endif
+
@@ -1,10 +1,25 @@
 #include <QAction>
 #include <QObject>
 #include <QImage>
-//#include <QTime>
-//#include <iostream>
+#include <QTransform>
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
+// the AVX2 version is compiled for that target on its own and only called
+// if the cpu supports it, the rest of the program stays at the base flags
+#if defined(__SSE2__) && defined(__GNUC__)
+#	define INVERT_AVX2
+#	include <immintrin.h>
+#endif
+#include <algorithm>
+#if QT_VERSION >= 0x050000
+#	include <poppler-qt5.h>
+#else
+#	include <poppler-qt4.h>
+#endif
 #include "util.h"
 #include "config.h"
+#include "profiler.h"
 
 
 using namespace std;
@@ -59,28 +74,127 @@ void add_action(QWidget *base, const char *action, const char *slot, QWidget *re
 	}
 }
 
+// every channel value maps to a fixed result
+class InvertTable {
+public:
+	InvertTable(float contrast, int offset) {
+		for (int i = 0; i < 256; i++) {
+			int v = (255 - i) * contrast + offset;
+			value[i] = max(0, min(255, v));
+		}
+	}
+
+	unsigned char value[256];
+};
+
+// inverts and maps every channel c to c * contrast + offset, alpha becomes opaque
+// 8.8 fixed point, contrast_fp = contrast * 256
+#ifdef INVERT_AVX2
+__attribute__((target("avx2")))
+static QRgb *invert_pixels_avx2(QRgb *pixels, QRgb *pixels_end, int contrast_fp, int offset) {
+	const __m256i invert_mask = _mm256_set1_epi32(0x00ffffff);
+	const __m256i alpha = _mm256_set1_epi32(0xff000000);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i contrast = _mm256_set1_epi16(contrast_fp);
+	const __m256i off = _mm256_set1_epi16(offset);
+	for (; pixels + 8 <= pixels_end; pixels += 8) {
+		__m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels));
+		p = _mm256_xor_si256(p, invert_mask);
+		// unpack works per 128 bit lane, pack restores the order
+		__m256i lo = _mm256_unpacklo_epi8(p, zero);
+		__m256i hi = _mm256_unpackhi_epi8(p, zero);
+		lo = _mm256_add_epi16(_mm256_srli_epi16(_mm256_mullo_epi16(lo, contrast), 8), off);
+		hi = _mm256_add_epi16(_mm256_srli_epi16(_mm256_mullo_epi16(hi, contrast), 8), off);
+		p = _mm256_or_si256(_mm256_packus_epi16(lo, hi), alpha);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(pixels), p);
+	}
+	return pixels;
+}
+#endif
+
+#ifdef __SSE2__
+static QRgb *invert_pixels_sse2(QRgb *pixels, QRgb *pixels_end, int contrast_fp, int offset) {
+	const __m128i invert_mask = _mm_set1_epi32(0x00ffffff);
+	const __m128i alpha = _mm_set1_epi32(0xff000000);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i contrast = _mm_set1_epi16(contrast_fp);
+	const __m128i off = _mm_set1_epi16(offset);
+	for (; pixels + 4 <= pixels_end; pixels += 4) {
+		__m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels));
+		p = _mm_xor_si128(p, invert_mask);
+		__m128i lo = _mm_unpacklo_epi8(p, zero);
+		__m128i hi = _mm_unpackhi_epi8(p, zero);
+		lo = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(lo, contrast), 8), off);
+		hi = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(hi, contrast), 8), off);
+		p = _mm_or_si128(_mm_packus_epi16(lo, hi), alpha);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(pixels), p);
+	}
+	return pixels;
+}
+#endif
+
 void invert_image(QImage *img) {
-	static QRgb invert_mask = qRgba(255, 255, 255, 0);
 	static float inverted_contrast =
 			CFG::get_instance()->get_value("Settings/inverted_color_contrast").toFloat();
 	static int offset = 255 *
 			CFG::get_instance()->get_value("Settings/inverted_color_brightening").toFloat();
-//	QTime time;
-//	time.start();
+	static int contrast_fp = inverted_contrast * 256 + 0.5f;
+	static const InvertTable table(inverted_contrast, offset);
+#ifdef INVERT_AVX2
+	static bool has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+	qint64 start = Profiler::get_instance()->begin();
 
 //	img->invertPixels();
 
 	QRgb *pixels = reinterpret_cast<QRgb *>(img->bits());
 	QRgb *pixels_end = pixels + img->width() * img->height();
 
+	// the vector versions can't overflow 16 bits in this range
+	if (contrast_fp >= 0 && contrast_fp <= 256 && offset >= 0 && offset <= 255) {
+#ifdef INVERT_AVX2
+		if (has_avx2) {
+			pixels = invert_pixels_avx2(pixels, pixels_end, contrast_fp, offset);
+		}
+#endif
+#ifdef __SSE2__
+		pixels = invert_pixels_sse2(pixels, pixels_end, contrast_fp, offset);
+#endif
+	}
+
+	// remaining pixels
 	while (pixels < pixels_end) {
-		*pixels ^= invert_mask;
-		*pixels = qRgb(
-				(qRed(*pixels)) * inverted_contrast + offset,
-				(qGreen(*pixels)) * inverted_contrast + offset,
-				(qBlue(*pixels)) * inverted_contrast + offset);
+		*pixels = qRgb(table.value[qRed(*pixels)], table.value[qGreen(*pixels)], table.value[qBlue(*pixels)]);
 		++pixels;
 	}
-//	cout << time.elapsed() << "ms elapsed" << endl;
+	Profiler::get_instance()->end(Profile::Invert, start);
+}
+
+void rotate_image(QImage *img, int quarter_turns) {
+	quarter_turns = (quarter_turns % 4 + 4) % 4;
+	if (quarter_turns == 0 || img->isNull()) {
+		return;
+	}
+	qint64 start = Profiler::get_instance()->begin();
+	// right angles are plain pixel moves, Qt transposes in cache sized blocks
+	QTransform trans;
+	trans.rotate(quarter_turns * 90);
+	*img = img->transformed(trans);
+	Profiler::get_instance()->end(Profile::Rotate, start);
 }
 
+
+void set_render_hints(Poppler::Document *doc) {
+	doc->setRenderHint(Poppler::Document::Antialiasing, true);
+	doc->setRenderHint(Poppler::Document::TextAntialiasing, true);
+	doc->setRenderHint(Poppler::Document::TextHinting, true);
+#if POPPLER_VERSION >= POPPLER_VERSION_CHECK(0, 18, 0)
+	doc->setRenderHint(Poppler::Document::TextSlightHinting, true);
+#endif
+#if POPPLER_VERSION >= POPPLER_VERSION_CHECK(0, 22, 0)
+//	doc->setRenderHint(Poppler::Document::OverprintPreview, true); // TODO what is this?
+#endif
+#if POPPLER_VERSION >= POPPLER_VERSION_CHECK(0, 24, 0)
+	doc->setRenderHint(Poppler::Document::ThinLineSolid, true); // TODO what's the difference between ThinLineSolid and ThinLineShape?
+#endif
+}
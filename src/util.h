@@ -6,6 +6,9 @@
 
 
 class QImage;
+namespace Poppler {
+	class Document;
+}
 
 
 #define POPPLER_VERSION ((POPPLER_VERSION_MAJOR << 16) | (POPPLER_VERSION_MINOR << 8) | (POPPLER_VERSION_MICRO))
@@ -26,6 +29,10 @@ QRect transform_rect_expand(const QRectF &rect, float scale, int off_x, int off_
 void add_action(QWidget *base, const char *action, const char *slot, QWidget *receiver);
 
 void invert_image(QImage *img);
+// by multiples of 90 degrees clockwise, without any loss
+void rotate_image(QImage *img, int quarter_turns);
+
+void set_render_hints(Poppler::Document *doc);
 
 #endif
 
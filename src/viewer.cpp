@@ -41,7 +41,7 @@ Viewer::Viewer(const QString &file, QWidget *parent) :
 		}
 	}
 
-	search_bar = new SearchBar(file, this, this);
+	search_bar = new SearchBar(this, this);
 	if (!search_bar->is_valid()) {
 		if (CFG::get_instance()->get_most_current_value("Settings/quit_on_init_fail").toBool()) {
 			valid = false;
@@ -188,7 +188,7 @@ void Viewer::reload(bool clamp) {
 	res->load(res->get_file(), info_password.text().toLatin1());
 
 	search_bar->reset_search(); // TODO restart search if loading the same document?
-	search_bar->load(res->get_file(), info_password.text().toLatin1());
+	search_bar->load();
 
 	update_info_widget();
 
@@ -2,10 +2,12 @@
 #include "resourcemanager.h"
 #include "kpage.h"
 #include "canvas.h"
-#include "selection.h"
 #include "util.h"
 #include "config.h"
+#include "profiler.h"
+#include "documentpool.h"
 #include <list>
+#include <algorithm>
 #include <iostream>
 #if QT_VERSION >= 0x050000
 #	include <poppler-qt5.h>
@@ -16,225 +18,398 @@
 using namespace std;
 
 
-Worker::Worker(ResourceManager *res) :
-		die(false),
-		res(res) {
+// how long to wait after the document could not be opened, doubled with
+// every further failure
+static const unsigned long failure_delay = 100; // ms
+static const unsigned long max_failure_delay = 10000; // ms
+
+
+// page sizes in the resource manager may still be placeholders, ask poppler
+static QSizeF rotated_size(Poppler::Page *p, int rotation) {
+	QSizeF size = p->pageSizeF();
+	if (rotation == 1 || rotation == 3) {
+		size.transpose();
+	}
+	return size;
+}
+
+// returns how many bytes the tile map grew
+static int store_tile(map<TileKey,QImage> &tiles, const TileKey &key, const QImage &img) {
+	int bytes = img.bytesPerLine() * img.height();
+	map<TileKey,QImage>::iterator it = tiles.find(key);
+	if (it != tiles.end()) {
+		bytes -= it->second.bytesPerLine() * it->second.height();
+	}
+	tiles[key] = img;
+	return bytes;
+}
+
+Worker::Worker(ResourceManager *res, int id) :
+		res(res),
+		profiler(Profiler::get_instance()),
+		id(id),
+		doc(NULL),
+		priority(Render::Visible),
+		aborted(false) {
 	// load config options
 	CFG *config = CFG::get_instance();
-	smooth_downscaling = config->get_value("Settings/thumbnail_filter").toBool();
-	thumbnail_size = config->get_value("Settings/thumbnail_size").toInt();
+	preview_scale = config->get_value("Settings/preview_scale").toFloat();
+	tile_size = config->get_value("Settings/tile_size").toInt();
+	render_deadline = config->get_value("Settings/render_deadline").toInt();
 }
 
 void Worker::run() {
-	while (1) {
-		res->requestSemaphore.acquire(1);
-		if (die) {
-			break;
-		}
+	if (res->documents.isNull()) { // nothing to render
+		return;
+	}
+	if (id == 0) {
+		res->disk_cache.prune();
+	}
 
-		// get next page to render
-		res->requestMutex.lock();
-		int page, width, index;
-		map<int,Request>::iterator less = res->requests.lower_bound(res->center_page);
-		map<int,Request>::iterator greater = less--;
-		map<int,Request>::iterator closest;
-
-		if (greater != res->requests.end()) {
-			if (greater != res->requests.begin()) {
-				// favour nearby page, go down first
-				if (greater->first + less->first <= res->center_page * 2) {
-					closest = greater;
-				} else {
-					closest = less;
-				}
+	unsigned long delay = 0;
+	while (res->scheduler.pop(job, priority)) {
+		doc = res->documents->acquire();
+		if (doc == NULL) {
+			// the file is probably gone until the next reload; the view asks
+			// again when it redraws for another reason, don't make it redraw
+			if (delay == 0) {
+				cerr << "failed to open document for render thread " << id << endl;
+				delay = failure_delay;
 			} else {
-				closest = greater;
+				delay = min(delay * 2, max_failure_delay);
 			}
-		} else {
-			closest = less;
+			res->scheduler.abort(job, priority, false);
+			msleep(delay);
+			continue;
 		}
-
-		page = closest->first;
-		index = closest->second.get_lowest_index();
-		width = closest->second.width[index];
-		if (closest->second.remove_index_ok(index)) {
-			res->requestSemaphore.release(1);
+		delay = 0;
+		if (job.kind == RenderJob::Tile) {
+			render_tile(job.page, job.tile);
+		} else if (job.kind == RenderJob::Preview) {
+			render_preview(job.page, job.width, job.index);
 		} else {
-			res->requests.erase(closest);
+			render_page(job.page, job.width, job.index);
 		}
-		res->requestMutex.unlock();
+		res->documents->release(doc);
+		doc = NULL;
+	}
+}
 
-		// check for duplicate requests
-		KPage &kp = res->k_page[page];
+void Worker::render_page(int page, int width, int index) {
+	KPage &kp = res->k_page[page];
 
-		kp.mutex.lock();
-		bool render_new = true;
-		if (kp.status[index] == width && kp.rotation[index] == res->rotation) {
-			if (kp.img[index].isNull()) { // only invert colors
-				render_new = false;
-			} else { // nothing to do
-				kp.mutex.unlock();
-				continue;
-			}
+	// the rotation changed, turn the existing image instead of rendering it again;
+	// the new width may already be the requested one
+	if (rotate_page(page, index)) {
+		emit page_rendered(page);
+	}
+
+	// check for duplicate requests
+	kp.mutex.lock();
+	bool render_new = true;
+	if (kp.status[index] == width && kp.rotation[index] == res->rotation) {
+		if (kp.img[index].isNull()) { // only invert colors
+			render_new = false;
+		} else { // nothing to do
+			kp.mutex.unlock();
+			return;
 		}
-		int rotation = res->rotation;
-		kp.mutex.unlock();
+	}
+	int rotation = res->rotation;
+	kp.mutex.unlock();
 
-		// open page
+	// open page
 #ifdef DEBUG
-		cerr << "    rendering page " << page << " for index " << index << ", center: " << res->center_page << endl;
+	cerr << "    thread " << id << " rendering page " << page << " for index " << index << endl;
 #endif
-		Poppler::Page *p = NULL;
-		if (render_new) {
-			p = res->doc->page(page);
-			if (p == NULL) {
-				cerr << "failed to load page " << page << endl;
-				continue;
-			}
+	Poppler::Page *p = NULL;
+	QImage new_img;
+	bool store = false;
+	if (render_new) {
+		p = doc->page(page);
+		if (p == NULL) {
+			cerr << "failed to load page " << page << endl;
+			return;
+		}
 
-			// render page
-			float dpi = 72.0 * width / res->get_page_width(page);
-			QImage img = p->renderToImage(dpi, dpi, -1, -1, -1, -1,
-					static_cast<Poppler::Page::Rotation>(rotation));
+		// render page, unless it is in the disk cache
+		qint64 start = profiler->begin();
+		QImage img = res->disk_cache.load(page, width, rotation);
+		if (!img.isNull()) {
+			profiler->end(Profile::DiskLoad, start);
+		} else {
+			float dpi = 72.0 * width / rotated_size(p, rotation).width();
+			start = profiler->begin();
+			img = render(p, dpi, -1, -1, -1, -1, rotation);
+			profiler->end(Profile::Render, start);
+			if (aborted) {
+				finish_aborted();
+				delete p;
+				return;
+			}
 
 			if (img.isNull()) {
 				cerr << "failed to render page " << page << endl;
-				continue;
+				delete p;
+				return;
 			}
-
-			// insert new image
-			kp.mutex.lock();
-			if (kp.inverted_colors) {
-				kp.img[index] = QImage();
-				kp.img_other[index] = img;
-			} else {
-				kp.img[index] = img;
-				kp.img_other[index] = QImage();
-			}
-			kp.status[index] = width;
-			kp.rotation[index] = rotation;
-		} else {
-			// image already exists
-			kp.mutex.lock();
+			store = true;
 		}
 
+		// insert new image
+		new_img = img;
+		kp.mutex.lock();
 		if (kp.inverted_colors) {
-			// generate inverted image
-			kp.img[index] = kp.img_other[index];
-			invert_image(&kp.img[index]);
+			kp.img[index] = QImage();
+			kp.img_other[index] = img;
+		} else {
+			kp.img[index] = img;
+			kp.img_other[index] = QImage();
 		}
+		kp.status[index] = width;
+		kp.rotation[index] = rotation;
+	} else {
+		// image already exists
+		kp.mutex.lock();
+	}
 
-		// create thumbnail
-		if (kp.thumbnail.isNull()) {
-			Qt::TransformationMode mode = Qt::FastTransformation;
-			if (smooth_downscaling) {
-				mode = Qt::SmoothTransformation;
-			}
-			// scale
-			if (kp.inverted_colors) {
-				kp.thumbnail = kp.img_other[index].scaled(QSize(thumbnail_size, thumbnail_size), Qt::IgnoreAspectRatio, mode);
-			} else {
-				kp.thumbnail = kp.img[index].scaled(QSize(thumbnail_size, thumbnail_size), Qt::IgnoreAspectRatio, mode);
-			}
-			// rotate
-			if (kp.rotation[index] != 0) {
-				QTransform trans;
-				trans.rotate(-kp.rotation[index] * 90);
-				kp.thumbnail = kp.thumbnail.transformed(trans);
-			}
-			kp.thumbnail_other = kp.thumbnail;
-			invert_image(&kp.thumbnail_other);
-			if (kp.inverted_colors) {
-				kp.thumbnail.swap(kp.thumbnail_other);
-			}
-		}
+	if (kp.inverted_colors) {
+		// generate inverted image
+		kp.img[index] = kp.img_other[index];
+		invert_image(&kp.img[index]);
+	}
+
+	kp.mutex.unlock();
+
+	res->cache_insert(page, index);
+	if (!new_img.isNull()) {
+		res->set_thumbnail(page, new_img, rotation);
+	}
+
+	emit page_rendered(page);
+
+	// links and text are extracted separately, once rendering is done
+	if (res->text_worker != NULL) {
+		res->text_worker->prefetch(page);
+	}
+
+	// the page is already on screen, don't make it wait for the png encoder
+	if (store) {
+		qint64 start = profiler->begin();
+		res->disk_cache.store(page, width, rotation, new_img);
+		profiler->end(Profile::DiskStore, start);
+	}
+
+	delete p;
+}
+
+bool Worker::rotate_page(int page, int index) {
+	KPage &kp = res->k_page[page];
+
+	kp.mutex.lock();
+	int rotation = res->rotation;
+	int old_rotation = kp.rotation[index];
+	QImage img = kp.img[index];
+	QImage other = kp.img_other[index];
+	kp.mutex.unlock();
+	if (old_rotation == rotation || (img.isNull() && other.isNull())) {
+		return false;
+	}
+
+	// the copies share their data, no need to hold the lock
+	qint64 img_key = img.cacheKey();
+	qint64 other_key = other.cacheKey();
+	rotate_image(&img, rotation - old_rotation);
+	rotate_image(&other, rotation - old_rotation);
+
+	kp.mutex.lock();
+	// a render or the garbage collection got there first
+	if (kp.rotation[index] != old_rotation ||
+			kp.img[index].cacheKey() != img_key ||
+			kp.img_other[index].cacheKey() != other_key) {
 		kp.mutex.unlock();
+		return false;
+	}
+	kp.img[index] = img;
+	kp.img_other[index] = other;
+	kp.status[index] = img.isNull() ? other.width() : img.width();
+	kp.rotation[index] = rotation;
+	kp.mutex.unlock();
+	return true;
+}
 
-		res->garbageMutex.lock();
-		res->garbage[index].insert(page);
-		res->garbageMutex.unlock();
+QImage Worker::render(Poppler::Page *p, float dpi, int x, int y, int w, int h, int rotation) {
+	aborted = false;
+	render_clock.start();
+#if QT_VERSION >= 0x050000 && POPPLER_VERSION >= POPPLER_VERSION_CHECK(0, 63, 0)
+	return p->renderToImage(dpi, dpi, x, y, w, h,
+			static_cast<Poppler::Page::Rotation>(rotation), NULL, NULL, should_abort,
+			QVariant(static_cast<qulonglong>(reinterpret_cast<quintptr>(this))));
+#else
+	return p->renderToImage(dpi, dpi, x, y, w, h,
+			static_cast<Poppler::Page::Rotation>(rotation));
+#endif
+}
 
-		emit page_rendered(page);
+// called by poppler while rendering, payload is the worker
+bool Worker::should_abort(const QVariant &payload) {
+	Worker *w = reinterpret_cast<Worker *>(static_cast<quintptr>(payload.toULongLong()));
+	if (w->aborted) {
+		return true;
+	}
+	// the page is gone
+	if (w->res->scheduler.is_cancelled(w->job)) {
+		w->aborted = true;
+	// the page is not visible and holds up the ones that are
+	} else if (w->priority != Render::Visible && w->render_deadline > 0 &&
+			w->render_clock.elapsed() > w->render_deadline &&
+			w->res->scheduler.is_waiting(Render::Visible)) {
+		w->aborted = true;
+	}
+	return w->aborted;
+}
 
-		// collect goto links
-		res->link_mutex.lock();
-		if (kp.links == NULL) {
-			res->link_mutex.unlock();
+void Worker::finish_aborted() {
+	bool retry = !res->scheduler.is_cancelled(job);
+#ifdef DEBUG
+	cerr << "    thread " << id << " aborted page " << job.page << (retry ? ", retrying later" : "") << endl;
+#endif
+	res->scheduler.abort(job, priority, retry);
+}
 
-			QList<Poppler::Link *> *links = new QList<Poppler::Link *>;
-			QList<Poppler::Link *> l = p->links();
-			links->swap(l);
+void Worker::render_preview(int page, int width, int index) {
+	KPage &kp = res->k_page[page];
 
-			res->link_mutex.lock();
-			kp.links = links;
+	// only needed as long as there is nothing better to show
+	kp.mutex.lock();
+	bool has_image = false;
+	for (int i = 0; i < render_index_count; i++) {
+		if (!kp.img[i].isNull() || !kp.img_other[i].isNull()) {
+			has_image = true;
 		}
-		if (kp.text == NULL) {
-			res->link_mutex.unlock();
-
-			QList<Poppler::TextBox *> text = p->textList();
-			// assign boxes to lines
-			// make single parts from chained boxes
-			set<Poppler::TextBox *> used;
-			QList<SelectionPart *> selection_parts;
-			Q_FOREACH(Poppler::TextBox *box, text) {
-				if (used.find(box) != used.end()) {
-					continue;
-				}
-				used.insert(box);
-
-				SelectionPart *p = new SelectionPart(box);
-				selection_parts.push_back(p);
-				Poppler::TextBox *next = box->nextWord();
-				while (next != NULL) {
-					used.insert(next);
-					p->add_word(next);
-					next = next->nextWord();
-				}
-			}
+	}
+	int rotation = res->rotation;
+	kp.mutex.unlock();
+	if (has_image) {
+		return;
+	}
 
-			// sort by y coordinate
-			stable_sort(selection_parts.begin(), selection_parts.end(), selection_less_y);
-
-			QRectF line_box;
-			QList<SelectionLine *> *lines = new QList<SelectionLine *>();
-			Q_FOREACH(SelectionPart *part, selection_parts) {
-				QRectF box = part->get_bbox();
-				// box fits into line_box's line
-				if (!lines->empty() && box.y() <= line_box.center().y() && box.bottom() > line_box.center().y()) {
-					float ratio_w = box.width() / line_box.width();
-					float ratio_h = box.height() / line_box.height();
-					if (ratio_w < 1.0f) {
-						ratio_w = 1.0f / ratio_w;
-					}
-					if (ratio_h < 1.0f) {
-						ratio_h = 1.0f / ratio_h;
-					}
-					if (ratio_w > 1.3f && ratio_h > 1.3f) {
-						lines->back()->sort();
-						lines->push_back(new SelectionLine(part));
-						line_box = part->get_bbox();
-					} else {
-						lines->back()->add_part(part);
-					}
-				// it doesn't fit, create new line
-				} else {
-					if (!lines->empty()) {
-						lines->back()->sort();
-					}
-					lines->push_back(new SelectionLine(part));
-					line_box = part->get_bbox();
-				}
-			}
-			if (!lines->empty()) {
-				lines->back()->sort();
-			}
+	int preview_width = width * preview_scale;
+	if (preview_width < 1) {
+		preview_width = 1;
+	}
 
-			res->link_mutex.lock();
-			kp.text = lines;
-		}
-		res->link_mutex.unlock();
+#ifdef DEBUG
+	cerr << "    thread " << id << " rendering preview of page " << page << " for index " << index << endl;
+#endif
+	Poppler::Page *p = doc->page(page);
+	if (p == NULL) {
+		cerr << "failed to load page " << page << endl;
+		return;
+	}
+	float dpi = 72.0 * preview_width / rotated_size(p, rotation).width();
+	qint64 start = profiler->begin();
+	QImage img = render(p, dpi, -1, -1, -1, -1, rotation);
+	profiler->end(Profile::Preview, start);
+	delete p;
+	if (aborted) {
+		finish_aborted();
+		return;
+	}
 
+	if (img.isNull()) {
+		cerr << "failed to render preview of page " << page << endl;
+		return;
+	}
+
+	kp.mutex.lock();
+	// a full render may have finished in the meantime
+	if (!kp.img[index].isNull() || !kp.img_other[index].isNull()) {
+		kp.mutex.unlock();
+		return;
+	}
+	// the differing width makes sure the full resolution version gets rendered
+	if (kp.inverted_colors) {
+		kp.img_other[index] = img;
+		kp.img[index] = img;
+		invert_image(&kp.img[index]);
+	} else {
+		kp.img[index] = img;
+	}
+	kp.status[index] = preview_width;
+	kp.rotation[index] = rotation;
+	kp.mutex.unlock();
+
+	res->cache_insert(page, index);
+	res->set_thumbnail(page, img, rotation);
+
+	emit page_rendered(page);
+}
+
+void Worker::render_tile(int page, const TileKey &key) {
+	KPage &kp = res->k_page[page];
+
+	kp.mutex.lock();
+	if (kp.tiles.find(key) != kp.tiles.end()) { // nothing to do
+		kp.mutex.unlock();
+		return;
+	}
+	map<TileKey,QImage>::iterator other = kp.tiles_other.find(key);
+	if (kp.inverted_colors && other != kp.tiles_other.end()) { // only invert colors
+		QImage img = other->second;
+		invert_image(&img);
+		res->add_tile_bytes(store_tile(kp.tiles, key, img));
+		kp.mutex.unlock();
+		emit page_rendered(page);
+		return;
+	}
+	kp.mutex.unlock();
+
+	Poppler::Page *p = doc->page(page);
+	if (p == NULL) {
+		cerr << "failed to load page " << page << endl;
+		return;
+	}
+
+	// the key holds the rotated width
+	QSizeF size = rotated_size(p, key.rotation);
+	float dpi = 72.0 * key.width / size.width();
+	int x = key.col * tile_size;
+	int y = key.row * tile_size;
+	int w = min(tile_size, key.width - x);
+	int h = min(tile_size, (int) ROUND(size.height() * dpi / 72.0) - y);
+	if (w <= 0 || h <= 0) {
 		delete p;
+		return;
 	}
+
+#ifdef DEBUG
+	cerr << "    thread " << id << " rendering tile " << key.col << "/" << key.row << " of page " << page << endl;
+#endif
+	qint64 start = profiler->begin();
+	QImage img = render(p, dpi, x, y, w, h, key.rotation);
+	profiler->end(Profile::Tile, start);
+	delete p;
+	if (aborted) {
+		finish_aborted();
+		return;
+	}
+
+	if (img.isNull()) {
+		cerr << "failed to render tile of page " << page << endl;
+		return;
+	}
+
+	kp.mutex.lock();
+	int bytes = 0;
+	if (kp.inverted_colors) {
+		bytes += store_tile(kp.tiles_other, key, img);
+		invert_image(&img);
+	}
+	bytes += store_tile(kp.tiles, key, img);
+	res->add_tile_bytes(bytes);
+	kp.mutex.unlock();
+
+	emit page_rendered(page);
 }
 
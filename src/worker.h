@@ -2,30 +2,60 @@
 #define WORKER_H
 
 #include <QThread>
+#include <QElapsedTimer>
+#include <QImage>
+#include "scheduler.h"
 
 
 class ResourceManager;
 class Canvas;
+class Profiler;
+class QVariant;
+namespace Poppler {
+	class Document;
+	class Page;
+}
 
 
 class Worker : public QThread {
 	Q_OBJECT
 
 public:
-	Worker(ResourceManager *res);
+	Worker(ResourceManager *res, int id);
 	void run();
 
-	volatile bool die;
-
 signals:
 	void page_rendered(int page);
 
 private:
+	// renders until the job gets cancelled or misses its deadline, check aborted
+	QImage render(Poppler::Page *p, float dpi, int x, int y, int w, int h, int rotation);
+	static bool should_abort(const QVariant &payload);
+	void finish_aborted();
+
+	void render_page(int page, int width, int index);
+	// turns the page's image in place, returns false if there was nothing to do
+	bool rotate_page(int page, int index);
+	void render_preview(int page, int width, int index);
+	void render_tile(int page, const TileKey &key);
+
 	ResourceManager *res;
+	Profiler *profiler;
+
+	int id;
+	// borrowed from the resource manager's pool for the current job
+	Poppler::Document *doc;
+
+	// the job being rendered
+	RenderJob job;
+	Render::Priority priority;
+	QElapsedTimer render_clock;
+	bool aborted;
 
 	// config options
-	bool smooth_downscaling;
-	int thumbnail_size;
+	float preview_scale;
+	int tile_size;
+	int render_deadline; // ms
 };
 
 #endif